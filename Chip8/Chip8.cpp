@@ -1,6 +1,10 @@
 #include <cstdlib>
 #include <ctime>
+#include <cstddef>
+#include <cstring>
 #include "Chip8.h"
+#include "Debugger.h"
+#include "Trace.h"
 
 unsigned char chip8_fontset[80] = { 
 	0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
@@ -25,16 +29,39 @@ Chip8::Chip8() {
 	init();
 }
 
+Chip8::Chip8(const Chip8 & parent) {
+	paged = true;
+	for(unsigned int i = 0; i < MEMORY_PAGES; i ++) {
+		pages[i] = nullptr;
+	}
+	gfxBytes = nullptr;
+	copyFrom(parent);
+}
+
 Chip8::~Chip8() {
-	if(gfx != nullptr) {
-		delete [] gfx;
-		gfx = nullptr;
+	if(gfxBytes != nullptr) {
+		delete [] gfxBytes;
+		gfxBytes = nullptr;
+	}
+	if(paged) {
+		for(unsigned int i = 0; i < MEMORY_PAGES; i ++) {
+			releasePage(pages[i]);
+			pages[i] = nullptr;
+		}
 	}
 }
 
+Chip8 & Chip8::operator=(const Chip8 & other) {
+	if(this != &other) {
+		copyFrom(other);
+	}
+	return *this;
+}
+
 void Chip8::init() {
 	opcode = 0;
 	
+	paged = false;
 	for(unsigned int i = 0; i < 4096; i ++) {
 		if(i < 80) {
 			memory[i] = chip8_fontset[i];
@@ -52,13 +79,14 @@ void Chip8::init() {
 	pc = 0x200;
 
 	// Graphics stuff
-	width = 64;
-	height = 32;
-	gfx = new unsigned char [width * height];
-	for(unsigned int i = 0; i < width * height; i ++) {
+	width = GFX_WIDTH;
+	height = GFX_HEIGHT;
+	for(unsigned int i = 0; i < GFX_HEIGHT; i ++) {
 		gfx[i] = 0;
 	}
+	gfxBytes = nullptr;
 	needsRedraw = true;
+	spritesDrawn = 0;
 
 	delay_timer = 0;
 	sound_timer = 0;
@@ -73,19 +101,134 @@ void Chip8::init() {
 		key[i] = false;
 	}
 
-	srand( (unsigned int) time(NULL) ); // see RNG with the time
+	randomState = (unsigned int) time(NULL); // seed RNG with the time
+
+	// everything cycle() touches on a normal instruction should be in the first cache line
+	static_assert(offsetof(Chip8, randomState) + sizeof(randomState) <= CACHE_LINE, "Chip8 hot registers no longer fit in one cache line");
+}
+
+/*
+Forking
+-------
+Copy on write is only used by forks, an instance that is never forked keeps its memory flat and reads it directly.
+Registers, the stack and the framebuffer are copied, which is a few hundred bytes. A fork of a fork shares its pages by taking a reference,
+and writeByte() gives an instance its own copy of a page the first time it writes to one that is shared.
+Most games only write to memory with FX33 and FX55 to a handful of bytes, so the program and font are never copied.
+A plain instance can write its flat memory at any time, so forking one copies its memory into pages once.
+Reference counts are atomic so forks can be handed to other threads, but other must not be running while it is being forked.
+*/
+void Chip8::copyFrom(const Chip8 & other) {
+	for(unsigned int i = 0; i < 16; i ++) {
+		V[i] = other.V[i];
+		key[i] = other.key[i];
+		stack[i] = other.stack[i];
+	}
+	opcode = other.opcode;
+	I = other.I;
+	pc = other.pc;
+	sp = other.sp;
+	delay_timer = other.delay_timer;
+	sound_timer = other.sound_timer;
+	needsRedraw = other.needsRedraw;
+	spritesDrawn = other.spritesDrawn;
+	randomState = other.randomState;
+
+	width = other.width;
+	height = other.height;
+	for(unsigned int i = 0; i < GFX_HEIGHT; i ++) {
+		gfx[i] = other.gfx[i];
+	}
+
+	if(!paged) {
+		for(unsigned int i = 0; i < MEMORY_PAGES; i ++) {
+			memcpy(memory + i * MEMORY_PAGE_SIZE, other.paged ? other.pages[i]->bytes : other.memory + i * MEMORY_PAGE_SIZE, MEMORY_PAGE_SIZE);
+		}
+		return;
+	}
+
+	for(unsigned int i = 0; i < MEMORY_PAGES; i ++) {
+		if(!other.paged) {
+			// other's flat memory can't be shared, so copy it into a page of our own
+			if(pages[i] == nullptr || pages[i]->references != 1) {
+				releasePage(pages[i]);
+				pages[i] = new MemoryPage;
+				pages[i]->references = 1;
+			}
+			memcpy(pages[i]->bytes, other.memory + i * MEMORY_PAGE_SIZE, MEMORY_PAGE_SIZE);
+			continue;
+		}
+		if(pages[i] == other.pages[i]) {
+			continue; // already shared, leave the reference count alone
+		}
+		other.pages[i]->references ++;
+		releasePage(pages[i]);
+		pages[i] = other.pages[i];
+	}
+}
+
+template<bool paged>
+inline unsigned char Chip8::readByte(unsigned short address) {
+	if(!paged) {
+		return memory[address & 0xFFF];
+	}
+	return pages[(address & 0xFFF) / MEMORY_PAGE_SIZE]->bytes[address % MEMORY_PAGE_SIZE];
+}
+
+template<bool paged>
+inline unsigned short Chip8::readOpcode(unsigned short address) {
+	if(!paged) {
+		return memory[address & 0xFFF] << 8 | memory[(address + 1) & 0xFFF];
+	}
+	unsigned int offset = address % MEMORY_PAGE_SIZE;
+	if(offset == MEMORY_PAGE_SIZE - 1) {
+		return readByte<true>(address) << 8 | readByte<true>(address + 1);
+	}
+	const unsigned char * bytes = pages[(address & 0xFFF) / MEMORY_PAGE_SIZE]->bytes;
+	return bytes[offset] << 8 | bytes[offset + 1];
+}
+
+template<bool paged>
+inline void Chip8::writeByte(unsigned short address, unsigned char value) {
+	if(!paged) {
+		memory[address & 0xFFF] = value;
+		return;
+	}
+	MemoryPage *& page = pages[(address & 0xFFF) / MEMORY_PAGE_SIZE];
+	if(page->references != 1) {
+		// another instance can still see this page, write to a copy of it instead
+		MemoryPage * copy = new MemoryPage;
+		copy->references = 1;
+		memcpy(copy->bytes, page->bytes, MEMORY_PAGE_SIZE);
+		releasePage(page);
+		page = copy;
+	}
+	page->bytes[address % MEMORY_PAGE_SIZE] = value;
+}
+
+void Chip8::writeMemory(unsigned short address, unsigned char value) {
+	if(paged) {
+		writeByte<true>(address, value);
+	}
+	else {
+		writeByte<false>(address, value);
+	}
+}
+
+void Chip8::releasePage(MemoryPage * page) {
+	if(page != nullptr && -- page->references == 0) {
+		delete page;
+	}
 }
 
 void Chip8::loadGame(std::string gameName) {
 	char * rom = nullptr; // we will store the rom in a temporary area
 	unsigned long size = 0;
-	static unsigned int startPos = 0x200; // programs start at 0x200 in Chip8 normally
 	std::ifstream input(gameName, std::ios::binary);
 
 	if(input && input.is_open()) {
 		input.seekg(0, std::ios::end); // fast forward to end of stream/file
 		size = (unsigned long) input.tellg(); // record pos (so we can find out the size of the file)
-		if(size + startPos >= 4096) {
+		if(size + 0x200 >= 4096) {
 			// Check if loading the program will result in us overflowing the memory
 			std::cout << "Error: " << gameName << " is to large to load into memory" << std::endl;
 		}
@@ -101,17 +244,27 @@ void Chip8::loadGame(std::string gameName) {
 	}
 
 	if(rom != nullptr) {
-		for(unsigned int i = startPos; i < 4096 && i-startPos < size; i ++) {
-			// fill up the memory with the rom
-			memory[i] = (unsigned char) rom[i - startPos];
+		if(loadRom((const unsigned char *) rom, size)) {
+			std::cout << "Loaded " << gameName << std::endl;
 		}
-		std::cout << "Loaded " << gameName << std::endl;
 		delete [] rom; // deallocate the memory
 		rom = nullptr;
 	}
 	
 }
 
+bool Chip8::loadRom(const unsigned char * rom, unsigned long size) {
+	static unsigned int startPos = 0x200; // programs start at 0x200 in Chip8 normally
+	if(size + startPos >= 4096) {
+		return false;
+	}
+	for(unsigned int i = startPos; i < 4096 && i-startPos < size; i ++) {
+		// fill up the memory with the rom
+		writeMemory(i, rom[i - startPos]);
+	}
+	return true;
+}
+
 void Chip8::logUnknownOpcode(char * kind) {
 	std::cout.setf(std::ios::hex, std::ios::basefield);
 	std::cout << "Unknown " << kind << " opcode: 0x" << opcode << std::endl;
@@ -119,7 +272,59 @@ void Chip8::logUnknownOpcode(char * kind) {
 }
 
 void Chip8::cycle() {
-	opcode = memory[pc] << 8 | memory[pc + 1]; // fetch
+	if(paged) {
+		execute<false, true>(nullptr);
+	}
+	else {
+		execute<false, false>(nullptr);
+	}
+}
+
+void Chip8::debugCycle(Debugger & debugger) {
+	if(paged) {
+		execute<true, true>(&debugger);
+	}
+	else {
+		execute<true, false>(&debugger);
+	}
+}
+
+void Chip8::traceCycle(TraceWriter & trace, Debugger * debugger) {
+	TraceRecord record;
+	record.pc = pc;
+	unsigned char before[16];
+	memcpy(before, V, sizeof(V));
+
+	if(debugger != nullptr) {
+		debugCycle(*debugger);
+	}
+	else {
+		cycle();
+	}
+
+	record.opcode = opcode;
+	record.I = I;
+	record.changed = 0;
+	for(unsigned int i = 0; i < 16; i ++) {
+		if(V[i] != before[i]) {
+			record.changed |= 1 << i;
+			record.values[i] = V[i];
+		}
+		else {
+			record.values[i] = 0;
+		}
+	}
+	trace.append(record);
+}
+
+template<bool debugging, bool paged>
+inline void Chip8::execute(Debugger * debugger) {
+	execute<debugging, paged>(debugger, readOpcode<paged>(pc)); // fetch
+}
+
+template<bool debugging, bool paged>
+void Chip8::execute(Debugger * debugger, unsigned short fetched) {
+	opcode = fetched;
 
 	//TODO: Add Chip48/SuperChip8 opcodes!
 
@@ -144,7 +349,7 @@ void Chip8::cycle() {
 		case 0x00E0:
 			// 0x00E0 CLS
 			// Clear screen
-			for(unsigned int i = 0; i < width * height; i ++) {
+			for(unsigned int i = 0; i < GFX_HEIGHT; i ++) {
 				gfx[i] = 0;
 			}
 			needsRedraw = true;
@@ -399,7 +604,9 @@ void Chip8::cycle() {
 	case 0xC000:
 		// 0xCXNN RND Vx, byte
 		// Set Vx = (random number between 0 - 255) AND (NNN)
-		V[(opcode & 0x0F00) >> 8] = (rand() % 0xFF) & (opcode & 0x00FF);
+		// linear congruential generator from Numerical Recipes, the top byte is the most random part of it
+		randomState = randomState * 1664525 + 1013904223;
+		V[(opcode & 0x0F00) >> 8] = (unsigned char) (randomState >> 24) & (opcode & 0x00FF);
 		pc += 2;
 		break;
 
@@ -408,36 +615,10 @@ void Chip8::cycle() {
 		// 0xDXYN DRW Vx, Vy, nibble
 
 		// TODO: Add support for 8*16 and 16*16 sprites when using height of 0 (for Chip8 and SuperChip)
-
-		unsigned short x = V[(opcode & 0x0F00) >> 8];
-		unsigned short y = V[(opcode & 0x00F0) >> 4];
-		unsigned short height = opcode & 0x000F;
-		V[0xF] = 0; // set Vf to 0, will be set to 1 if any collisions occur
-
-		unsigned short pixel;
-		// for each row of the sprite
-		for(unsigned int yline = 0; yline < height; yline++) {
-			pixel = memory[I + yline]; // set whether we should draw a pixel or not
-
-			// for each pixel in the row
-			for(unsigned int xline = 0; xline < 8; xline++) {
-
-				// Check if there is a pixel that needs drawing present at that x and y in the sprite
-				if((pixel & (0x80 >> xline)) != 0) {
-
-					// check if there is a sprite already there in our graphics
-					if(gfx[(x + xline + ((y + yline) * width))] == 1) {
-						V[0xF] = 1; // if there is set the flag
-					}
-
-					gfx[x + xline + ((y + yline) * width)] ^= 1; // XOR onto the screen
-				}
-			}
+		if(debugging) {
+			debugger->memoryRead(I, opcode & 0x000F);
 		}
-		
-
-		needsRedraw = true; // set the flag to tell the emulator to redraw
-
+		drawSprite<paged>();
 		pc += 2;
 		break;}
 
@@ -448,7 +629,7 @@ void Chip8::cycle() {
 		case 0x009E:
 			// 0xEX9E SKP Vx
 			// Skip next opcode if key with value of Vx is pressed
-			if(key[V[(opcode & 0x0F00) >> 8]]) {
+			if(key[V[(opcode & 0x0F00) >> 8] & 0xF]) {
 				pc += 4; // skip
 			}
 			else {
@@ -459,7 +640,7 @@ void Chip8::cycle() {
 		case 0x00A1:
 			// 0xEXA1 SKNP Vx
 			// Skip next opcode if key with value of Vx is not pressed
-			if(!key[V[(opcode & 0x0F00) >> 8]]) {
+			if(!key[V[(opcode & 0x0F00) >> 8] & 0xF]) {
 				pc += 4; // skip
 			}
 			else {
@@ -552,10 +733,13 @@ void Chip8::cycle() {
 		case 0x0033:
 			// 0xFX33 LD B, Vx
 			// Store the BCD representations of the value of Vx in memory locations I, I+1, and I+2
+			if(debugging) {
+				debugger->memoryWrite(I, 3);
+			}
 			
-			memory[I] = V[(opcode & 0x0F00) >> 8] / 100;
-			memory[I + 1] = (V[(opcode & 0x0F00) >> 8] / 10) % 10;
-			memory[I + 2] = (V[(opcode & 0x0F00) >> 8] % 100) % 10;
+			writeByte<paged>(I, V[(opcode & 0x0F00) >> 8] / 100);
+			writeByte<paged>(I + 1, (V[(opcode & 0x0F00) >> 8] / 10) % 10);
+			writeByte<paged>(I + 2, (V[(opcode & 0x0F00) >> 8] % 100) % 10);
 
 			pc += 2;
 			break;
@@ -563,8 +747,11 @@ void Chip8::cycle() {
 		case 0x0055:
 			// 0xFX55 LD [I], Vx
 			// Store registers V0 through Vx in memory starting at location I
+			if(debugging) {
+				debugger->memoryWrite(I, ((opcode & 0x0F00) >> 8) + 1);
+			}
 			for(int i = 0; i <= ((opcode & 0x0F00) >> 8); i ++) {
-				memory[I + i] = V[i];
+				writeByte<paged>(I + i, V[i]);
 			}
 
 			// not sure on this line as it was found in an example emulator but the doc I have doesn't mention incrementing I
@@ -576,8 +763,11 @@ void Chip8::cycle() {
 		case 0x0065:
 			// 0xFX65 LD Vx, [I]
 			// Read values from memory into registers starting at I, going through Vx registers
+			if(debugging) {
+				debugger->memoryRead(I, ((opcode & 0x0F00) >> 8) + 1);
+			}
 			for(int i = 0; i <= ((opcode & 0x0F00) >> 8); i ++) {
-				V[i] = memory[I + i];
+				V[i] = readByte<paged>(I + i);
 			}
 			
 			// not sure on this line as it was found in an example emulator but the doc I have doesn't mention incrementing I
@@ -616,10 +806,182 @@ void Chip8::cycle() {
 	
 	}
 
+	tick();
+}
+
+template<bool paged>
+void Chip8::drawSprite() {
+	// The starting position wraps around the screen, anything drawn past the edges is clipped
+	unsigned short x = V[(opcode & 0x0F00) >> 8] % GFX_WIDTH;
+	unsigned short y = V[(opcode & 0x00F0) >> 4] % GFX_HEIGHT;
+	unsigned short rows = opcode & 0x000F;
+	V[0xF] = 0; // set Vf to 0, will be set to 1 if any collisions occur
+
+	unsigned long long pixels;
+	// for each row of the sprite
+	for(unsigned int yline = 0; yline < rows && y + yline < GFX_HEIGHT; yline++) {
+		// move the 8 sprite pixels to the top of a word then across to x, pixels pushed off the right are lost
+		pixels = ((unsigned long long) readByte<paged>(I + yline) << 56) >> x;
+
+		// check if there is a sprite already there in our graphics
+		if((gfx[y + yline] & pixels) != 0) {
+			V[0xF] = 1; // if there is set the flag
+		}
+
+		gfx[y + yline] ^= pixels; // XOR onto the screen
+	}
+
+	needsRedraw = true; // set the flag to tell the emulator to redraw
+	spritesDrawn ++;
+}
+
+void Chip8::tick() {
 	if(delay_timer > 0) delay_timer --;
 	if(sound_timer > 0) sound_timer --;
 }
 
+void Chip8::run(unsigned int cycles) {
+	if(paged) {
+		runCycles<true>(cycles);
+	}
+	else {
+		runCycles<false>(cycles);
+	}
+}
+
+// Bit n is set when an opcode starting with the hex digit n can begin a superinstruction, see executeFused().
+// Checked before calling it so instructions that can't start one don't pay for the call
+static const unsigned int FUSED_FIRST = 1 << 0x3 | 1 << 0x4 | 1 << 0x6 | 1 << 0xA | 1 << 0xE | 1 << 0xF;
+
+template<bool paged>
+void Chip8::runCycles(unsigned int cycles) {
+	while(cycles > 0) {
+		// fetched once here and handed on, so an instruction that isn't fused costs no more than in cycle()
+		unsigned short first = readOpcode<paged>(pc);
+		if(cycles >= 2 && (FUSED_FIRST >> (first >> 12)) & 1) {
+			unsigned int used = executeFused<paged>(first, cycles);
+			if(used > 0) {
+				cycles -= used;
+				continue;
+			}
+		}
+		execute<false, paged>(nullptr, first);
+		cycles --;
+	}
+}
+
+/*
+Superinstructions
+-----------------
+Compiled Chip 8 programs spend most of their time in a handful of instruction sequences.
+These are spotted when the first instruction is decoded by peeking at the ones after it and then run in one go,
+skipping the fetch and dispatch of the rest. Each instruction still counts as a cycle and the timers tick between them
+exactly as they would one at a time, nothing is cached so jumping into the middle of a sequence or code that
+rewrites itself behaves as normal. The opcodes after the first are only read when it could start a sequence, and one
+that doesn't is handed to execute() already fetched, so code with nothing to fuse runs as fast as it does through cycle().
+
+	3XKK/4XKK/EXA1 then 1NNN   skip over a jump, the usual way to write an if
+	6XKK then 6YKK             loading two registers
+	ANNN then DXYN             pointing I at a sprite and drawing it
+	FX07, 3X00 then 1NNN       waiting for the delay timer to run out
+*/
+template<bool paged>
+unsigned int Chip8::executeFused(unsigned short first, unsigned int budget) {
+	unsigned short x = (first & 0x0F00) >> 8;
+
+	switch(first & 0xF000) {
+
+	case 0x3000:
+	case 0x4000:
+	case 0xE000: {
+		if((first & 0xF000) == 0xE000 && (first & 0x00FF) != 0x00A1) {
+			return 0;
+		}
+		unsigned short second = readOpcode<paged>(pc + 2);
+		if((second & 0xF000) != 0x1000) {
+			return 0;
+		}
+		bool skip;
+		if((first & 0xF000) == 0x3000) {
+			skip = V[x] == (first & 0x00FF);
+		}
+		else if((first & 0xF000) == 0x4000) {
+			skip = V[x] != (first & 0x00FF);
+		}
+		else {
+			skip = !key[V[x] & 0xF];
+		}
+
+		opcode = first;
+		if(skip) {
+			// the jump never runs, so this was only one instruction
+			pc += 4;
+			tick();
+			return 1;
+		}
+		tick();
+		opcode = second;
+		pc = second & 0x0FFF;
+		tick();
+		return 2;}
+
+	case 0x6000: {
+		unsigned short second = readOpcode<paged>(pc + 2);
+		if((second & 0xF000) != 0x6000) {
+			return 0;
+		}
+		V[x] = first & 0x00FF;
+		tick();
+		V[(second & 0x0F00) >> 8] = second & 0x00FF;
+		tick();
+		opcode = second;
+		pc += 4;
+		return 2;}
+
+	case 0xA000: {
+		unsigned short second = readOpcode<paged>(pc + 2);
+		if((second & 0xF000) != 0xD000) {
+			return 0;
+		}
+		I = first & 0x0FFF;
+		tick();
+		opcode = second;
+		drawSprite<paged>();
+		tick();
+		pc += 4;
+		return 2;}
+
+	case 0xF000: {
+		if((first & 0x00FF) != 0x0007 || budget < 3) {
+			return 0;
+		}
+		unsigned short second = readOpcode<paged>(pc + 2);
+		if(second != (0x3000 | (x << 8))) {
+			return 0;
+		}
+		unsigned short third = readOpcode<paged>(pc + 4);
+		if((third & 0xF000) != 0x1000) {
+			return 0;
+		}
+		V[x] = delay_timer;
+		tick();
+		if(V[x] == 0) {
+			// timer has run out, skip the jump back
+			opcode = second;
+			pc += 6;
+			tick();
+			return 2;
+		}
+		tick();
+		opcode = third;
+		pc = third & 0x0FFF;
+		tick();
+		return 3;}
+	}
+
+	return 0;
+}
+
 
 // Graphics stuff
 
@@ -632,6 +994,18 @@ void Chip8::setNeedRedraw(bool set) {
 }
 
 const unsigned char * Chip8::getGraphics() {
+	if(gfxBytes == nullptr) {
+		gfxBytes = new unsigned char [GFX_WIDTH * GFX_HEIGHT];
+	}
+	for(unsigned int y = 0; y < GFX_HEIGHT; y ++) {
+		for(unsigned int x = 0; x < GFX_WIDTH; x ++) {
+			gfxBytes[x + (GFX_WIDTH * y)] = (unsigned char) ((gfx[y] >> (63 - x)) & 0x1);
+		}
+	}
+	return gfxBytes;
+}
+
+const unsigned long long * Chip8::getPackedGraphics() {
 	return gfx;
 }
 
@@ -646,4 +1020,51 @@ unsigned int Chip8::getHeight() {
 
 void Chip8::setKeyState(unsigned int key, bool state) {
 	this->key[key] = state;
+}
+
+void Chip8::setSeed(unsigned int seed) {
+	randomState = seed;
+}
+
+
+// Inspection
+
+unsigned short Chip8::getOpcode() {
+	return opcode;
+}
+
+unsigned short Chip8::getPC() {
+	return pc;
+}
+
+unsigned short Chip8::getI() {
+	return I;
+}
+
+unsigned char Chip8::getV(unsigned int index) {
+	return V[index & 0xF];
+}
+
+unsigned short Chip8::getSP() {
+	return sp;
+}
+
+unsigned short Chip8::getStack(unsigned int level) {
+	return stack[level & 0xF];
+}
+
+unsigned char Chip8::getDelayTimer() {
+	return delay_timer;
+}
+
+unsigned char Chip8::getSoundTimer() {
+	return sound_timer;
+}
+
+unsigned char Chip8::readMemory(unsigned short address) {
+	return paged ? readByte<true>(address) : readByte<false>(address);
+}
+
+unsigned int Chip8::getSpritesDrawn() {
+	return spritesDrawn;
 }
\ No newline at end of file
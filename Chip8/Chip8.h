@@ -2,10 +2,34 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <atomic>
 
-#define UPSCALE 10
+#define UPSCALE 10 // default scale, can be changed with --scale
 #define SPEED 60 // clock cycles a second
 
+class Debugger;
+class TraceWriter;
+
+#define GFX_WIDTH 64
+#define GFX_HEIGHT 32
+
+// A forked instance holds its memory in pages so it can share the ones neither it nor its relatives have written to
+#define MEMORY_PAGE_SIZE 256
+#define MEMORY_PAGES (4096 / MEMORY_PAGE_SIZE)
+
+struct MemoryPage {
+	std::atomic<unsigned int> references; // how many instances are using this page, only a page with one user can be written in place
+	unsigned char bytes[MEMORY_PAGE_SIZE];
+};
+
+// Size of a cache line in bytes, instances are aligned to this so their hot registers never straddle two lines
+#define CACHE_LINE 64
+#if defined(_MSC_VER)
+#define CACHE_ALIGNED __declspec(align(CACHE_LINE))
+#else
+#define CACHE_ALIGNED __attribute__((aligned(CACHE_LINE)))
+#endif
+
 /*
 Keypad                   Keyboard
 +-+-+-+-+                +-+-+-+-+
@@ -20,17 +44,31 @@ Keypad                   Keyboard
 */
 
 // http://www.multigesture.net/articles/how-to-write-an-emulator-chip-8-interpreter/
-class Chip8 {
+class CACHE_ALIGNED Chip8 {
 
 public:
 	Chip8();
+	// Forks parent, the child carries on from exactly the same state. Its memory is held in pages shared with parent,
+	// or copied from it the first time a plain instance is forked, and a page is only copied when one of them writes to it
+	Chip8(const Chip8 & parent);
 	~Chip8();
+	// Copies other's state. A fork shares other's pages, leaving alone the ones they already share so refreshing a fork is cheap,
+	// while an instance that was never forked copies the 4K of memory
+	Chip8 & operator=(const Chip8 & other);
 
 	// load a game into memory
 	void loadGame(std::string gameName);
+	// load a rom that has already been read into memory, returns false if it is too big
+	bool loadRom(const unsigned char * rom, unsigned long size);
 
 	// Emulates a cycle, should be called 60 times a second
 	void cycle();
+	// Emulates a cycle like cycle() but tells debugger about every memory access so watchpoints work
+	void debugCycle(Debugger & debugger);
+	// Emulates a cycle like cycle(), or like debugCycle() if debugger is set, and appends what the instruction did to trace
+	void traceCycle(TraceWriter & trace, Debugger * debugger = nullptr);
+	// Emulates cycles cycles, exactly like calling cycle() that many times but faster since common pairs of instructions are run together
+	void run(unsigned int cycles);
 	void decClocks();
 
 	// Check if the display needs updating
@@ -39,6 +77,8 @@ public:
 	void setNeedRedraw(bool set);
 	// Returns an array of width * height describing the display state
 	const unsigned char * getGraphics();
+	// Returns the display as height rows of 64 bits, the left most pixel is the most significant bit
+	const unsigned long long * getPackedGraphics();
 	// Returns the width of the display
 	unsigned int getWidth();
 	// Returns the height of the display
@@ -46,6 +86,24 @@ public:
 
 	// Sets whether a key is pressed or not
 	void setKeyState(unsigned int key, bool state);
+	// Seeds the random numbers CXKK draws from, two instances given the same seed and keys run identically.
+	// Each instance is seeded from the time when it is created and a fork carries on from its parent's sequence
+	void setSeed(unsigned int seed);
+
+	// Register and memory inspection, used by the debugger
+	unsigned short getOpcode();
+	unsigned short getPC();
+	unsigned short getI();
+	unsigned char getV(unsigned int index);
+	unsigned short getSP();
+	// Returns the address of the CALL saved at level of the stack, execution returns to the instruction after it. level must be less than getSP()
+	unsigned short getStack(unsigned int level);
+	unsigned char getDelayTimer();
+	unsigned char getSoundTimer();
+	unsigned char readMemory(unsigned short address);
+
+	// Returns how many sprites have been drawn since the game was loaded, wraps around
+	unsigned int getSpritesDrawn();
 
 	// Logs an unknown opcode to the debug output
 	void logUnknownOpcode(char * kind);
@@ -55,18 +113,81 @@ private:
 	// Called by constructor, sets defualts
 	void init();
 
-	// The Chip 8 has 35 opcodes which are all two bytes long
-	unsigned short opcode;
+	// The interpreter, instantiated without any debugging checks for cycle() and with them for debugCycle(),
+	// each for flat memory and for the paged memory of a fork
+	template<bool debugging, bool paged> void execute(Debugger * debugger);
+	// execute() for an opcode that has already been fetched from pc
+	template<bool debugging, bool paged> void execute(Debugger * debugger, unsigned short fetched);
+	// The body of run() for one kind of memory
+	template<bool paged> void runCycles(unsigned int cycles);
+	// Runs the instruction sequence starting with first, the opcode at pc, as one superinstruction if it is one,
+	// returns how many cycles it took or 0 if it isn't
+	template<bool paged> unsigned int executeFused(unsigned short first, unsigned int budget);
+	// The body of DXYN for the current opcode
+	template<bool paged> void drawSprite();
+	// Counts the timers down, done once a cycle
+	void tick();
+
+	// Copies the state of other and its memory, shared if this is a fork, the lazily built gfxBytes buffer is never shared
+	void copyFrom(const Chip8 & other);
+	// Memory access for flat memory or pages, picked at compile time so an instance that is never forked pays nothing for forking
+	template<bool paged> unsigned char readByte(unsigned short address);
+	// Reads the two byte opcode at address, with one page lookup unless it straddles two pages
+	template<bool paged> unsigned short readOpcode(unsigned short address);
+	// Writes a byte of memory, first taking a private copy of the page if it is shared
+	template<bool paged> void writeByte(unsigned short address, unsigned char value);
+	// writeByte() for whichever kind of memory this instance has
+	void writeMemory(unsigned short address, unsigned char value);
+	// Drops this instance's use of page, freeing it if nothing else uses it
+	static void releasePage(MemoryPage * page);
+
+	/*
+	Layout
+	------
+	Members are ordered by how often they are touched rather than by topic.
+	Everything cycle() reads or writes on a typical instruction comes first so it shares the first cache line of the object,
+	followed by the stack, the packed framebuffer and finally the 4K of memory.
+	The framebuffer lives inside the object so an instance is a single allocation that can be placed in a Chip8Arena.
+	A fork uses a table of reference counted pages in place of the 4K, so forking one copies a few hundred bytes instead of all of it.
+	*/
 
-	// The Chip 8 has 4K memory in total
-	unsigned char memory[4096];
-	
 	// CPU registers: The Chip 8 has 15 8-bit general purpose registers named V0,V1 up to VE. The 16th register is used  for the carry flag.
 	unsigned char V[16];
-	
+
+	// The Chip 8 has 35 opcodes which are all two bytes long
+	unsigned short opcode;
+
 	// There is an Index register I and a program counter (pc) which can have a value from 0x000 to 0xFFF (0 to 4095)
 	unsigned short I;
 	unsigned short pc;
+	unsigned short sp;
+
+	//Finally, the Chip 8 has a HEX based keypad (0x0-0xF), you can use an array to store the current state of the key.
+	bool key[16];
+
+	// Interupts and hardware registers. 
+	// The Chip 8 has none, but there are two timer registers that count at 60 Hz. 
+	// When set above zero they will count down to zero.
+	unsigned char delay_timer;
+	unsigned char sound_timer;
+
+	bool needsRedraw;
+	// Set for forks, memory is then in pages rather than memory
+	bool paged;
+
+	// How many times DXYN has run, for telemetry
+	unsigned int spritesDrawn;
+	// State of the random number generator used by CXKK, kept per instance so instances and threads don't share rand()
+	unsigned int randomState;
+	// The members above all fit in the first cache line, init() checks this still holds for randomState, the last of them
+
+	/*
+	It is important to know that the Chip 8 instruction set has opcodes that allow the program to jump to a certain address or call a subroutine. 
+	While the specification dont mention a stack, you will need to implement one as part of the interpreter yourself. 
+	The stack is used to remember the current location before a jump is performed. So anytime you perform a jump or call a subroutine, store the program counter in the stack before proceeding. 
+	The system has 16 levels of stack and in order to remember which level of the stack is used, you need to implement a stack pointer (sp).
+	*/
+	unsigned short stack[16];
 
 	/*
 	Memory Map
@@ -81,31 +202,24 @@ private:
 	Drawing is done in XOR mode and if a pixel is turned off as a result of drawing, the VF register is set. This is used for collision detection.
 
 	The graphics of the Chip 8 are black and white and the screen has a total of 2048 pixels (64 x 32). 
-	This can easily be implemented using an array that hold the pixel state (1 or 0).
+	This is stored packed, one 64 bit word per row with the left most pixel in the most significant bit, so a whole sprite row can be XORed in one go.
 
 	*/
 
 	unsigned int height;
 	unsigned int width;
-	unsigned char * gfx;
-	bool needsRedraw;
+	unsigned long long gfx[GFX_HEIGHT];
 
-	// Interupts and hardware registers. 
-	// The Chip 8 has none, but there are two timer registers that count at 60 Hz. 
-	// When set above zero they will count down to zero.
-	unsigned char delay_timer;
-	unsigned char sound_timer;
+	union {
+		// The Chip 8 has 4K memory in total
+		unsigned char memory[4096];
 
-	/*
-	It is important to know that the Chip 8 instruction set has opcodes that allow the program to jump to a certain address or call a subroutine. 
-	While the specification dont mention a stack, you will need to implement one as part of the interpreter yourself. 
-	The stack is used to remember the current location before a jump is performed. So anytime you perform a jump or call a subroutine, store the program counter in the stack before proceeding. 
-	The system has 16 levels of stack and in order to remember which level of the stack is used, you need to implement a stack pointer (sp).
-	*/
-	unsigned short stack[16];
-	unsigned short sp;
+		// A fork's memory instead, page n holds addresses n * MEMORY_PAGE_SIZE onwards and may be shared with other forks.
+		// A fork never uses memory so the table takes its place and instances stay the same size
+		MemoryPage * pages[MEMORY_PAGES];
+	};
 
-	//Finally, the Chip 8 has a HEX based keypad (0x0-0xF), you can use an array to store the current state of the key.
-	bool key[16];
+	// One byte per pixel copy of gfx handed out by getGraphics(), only allocated the first time it is asked for
+	unsigned char * gfxBytes;
 
 };
\ No newline at end of file
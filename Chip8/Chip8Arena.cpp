@@ -0,0 +1,57 @@
+#include <new>
+#include "Chip8Arena.h"
+
+Chip8Arena::Chip8Arena(unsigned int capacity) {
+	this->capacity = capacity;
+	size = 0;
+
+	// over allocate by a cache line so the first instance can be aligned, sizeof(Chip8) is already a multiple of CACHE_LINE
+	block = new unsigned char [capacity * sizeof(Chip8) + CACHE_LINE];
+	size_t offset = (size_t) block % CACHE_LINE;
+	base = offset == 0 ? block : block + (CACHE_LINE - offset);
+}
+
+Chip8Arena::~Chip8Arena() {
+	for(unsigned int i = 0; i < size; i ++) {
+		get(i)->~Chip8();
+	}
+	if(block != nullptr) {
+		delete [] block;
+		block = nullptr;
+		base = nullptr;
+	}
+}
+
+Chip8 * Chip8Arena::create() {
+	if(size >= capacity) {
+		return nullptr;
+	}
+	Chip8 * chip = new (base + (size * sizeof(Chip8))) Chip8();
+	size ++;
+	return chip;
+}
+
+Chip8 * Chip8Arena::fork(const Chip8 & parent) {
+	if(size >= capacity) {
+		return nullptr;
+	}
+	Chip8 * chip = new (base + (size * sizeof(Chip8))) Chip8(parent);
+	size ++;
+	return chip;
+}
+
+Chip8 * Chip8Arena::get(unsigned int index) {
+	return reinterpret_cast<Chip8 *>(base + (index * sizeof(Chip8)));
+}
+
+unsigned int Chip8Arena::getSize() {
+	return size;
+}
+
+unsigned int Chip8Arena::getCapacity() {
+	return capacity;
+}
+
+size_t Chip8Arena::getBytes() {
+	return capacity * sizeof(Chip8) + CACHE_LINE;
+}
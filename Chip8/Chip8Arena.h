@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include "Chip8.h"
+
+/*
+Allocates Chip8 instances back to back from one contiguous block of memory.
+Every instance starts on a cache line boundary and there is no per instance heap allocation,
+so running hundreds of thousands of machines has a predictable footprint and walks memory in order.
+Instances made with fork() are the exception, their memory is held in pages on the heap that they share with the rest of their family.
+*/
+class Chip8Arena {
+
+public:
+	// Reserves room for capacity instances, none are constructed until create() is called
+	Chip8Arena(unsigned int capacity);
+	~Chip8Arena();
+
+	// Constructs the next instance in the arena, returns nullptr when the arena is full
+	Chip8 * create();
+	// Constructs the next instance as a fork of parent, returns nullptr when the arena is full
+	Chip8 * fork(const Chip8 & parent);
+	// Returns the instance at index, which must be less than getSize()
+	Chip8 * get(unsigned int index);
+
+	// Returns how many instances have been created
+	unsigned int getSize();
+	// Returns how many instances the arena can hold
+	unsigned int getCapacity();
+	// Returns the number of bytes reserved by the arena
+	size_t getBytes();
+
+private:
+
+	// The arena owns its instances so it can't be copied
+	Chip8Arena(const Chip8Arena & other);
+	Chip8Arena & operator=(const Chip8Arena & other);
+
+	unsigned char * block; // what was returned by new, kept so it can be deleted
+	unsigned char * base; // block rounded up to the next cache line
+	unsigned int size;
+	unsigned int capacity;
+
+};
@@ -0,0 +1,226 @@
+#include <sstream>
+#include <iomanip>
+#include "Debugger.h"
+#include "Trace.h"
+
+static const char * registerNames[] = {
+	"V0", "V1", "V2", "V3", "V4", "V5", "V6", "V7", "V8", "V9", "VA", "VB", "VC", "VD", "VE", "VF", "I", "SP", "DT", "ST"
+};
+
+static const char * compareNames[] = { "==", "!=", "<", ">" };
+
+Debugger::Debugger() {
+	for(unsigned int i = 0; i < 4096; i ++) {
+		breakAt[i] = false;
+		watch[i] = 0;
+	}
+	watchpointCount = 0;
+	stopped = false;
+	stoppedAt = 0;
+	watchHit = false;
+	trace = nullptr;
+}
+
+void Debugger::addBreakpoint(unsigned short address) {
+	Breakpoint breakpoint;
+	breakpoint.address = address & 0xFFF;
+	breakpoint.conditional = false;
+	breakpoint.reg = DEBUG_V0;
+	breakpoint.compare = COMPARE_EQUAL;
+	breakpoint.value = 0;
+	breakpoints.push_back(breakpoint);
+	breakAt[breakpoint.address] = true;
+}
+
+void Debugger::addConditionalBreakpoint(unsigned short address, DebugRegister reg, DebugCompare compare, unsigned short value) {
+	Breakpoint breakpoint;
+	breakpoint.address = address & 0xFFF;
+	breakpoint.conditional = true;
+	breakpoint.reg = reg;
+	breakpoint.compare = compare;
+	breakpoint.value = value;
+	breakpoints.push_back(breakpoint);
+	breakAt[breakpoint.address] = true;
+}
+
+void Debugger::removeBreakpoint(unsigned short address) {
+	address &= 0xFFF;
+	for(unsigned int i = 0; i < breakpoints.size(); i ++) {
+		if(breakpoints[i].address == address) {
+			breakpoints.erase(breakpoints.begin() + i);
+			i --;
+		}
+	}
+	breakAt[address] = false;
+}
+
+void Debugger::addWatchpoint(unsigned short start, unsigned short end, unsigned char flags) {
+	for(unsigned int i = start; i <= end && i < 4096; i ++) {
+		watch[i] |= flags;
+	}
+	watchpointCount ++;
+}
+
+void Debugger::clearWatchpoints() {
+	for(unsigned int i = 0; i < 4096; i ++) {
+		watch[i] = 0;
+	}
+	watchpointCount = 0;
+}
+
+bool Debugger::isActive() {
+	return !breakpoints.empty() || watchpointCount > 0;
+}
+
+bool Debugger::step(Chip8 & chip) {
+	// don't stop on the same breakpoint twice, stepping again means run it
+	bool resuming = stopped && chip.getPC() == stoppedAt;
+	stopped = false;
+
+	if(!resuming && breakAt[chip.getPC() & 0xFFF] && breakpointHit(chip)) {
+		stopped = true;
+		stoppedAt = chip.getPC();
+		return false;
+	}
+
+	watchHit = false;
+	if(trace != nullptr) {
+		chip.traceCycle(*trace, this);
+	}
+	else {
+		chip.debugCycle(*this);
+	}
+	if(watchHit) {
+		stopped = true;
+		stoppedAt = 0xFFFF; // the instruction has already run
+		return false;
+	}
+	return true;
+}
+
+void Debugger::setTrace(TraceWriter * trace) {
+	this->trace = trace;
+}
+
+std::string Debugger::getStopReason() {
+	return stopReason;
+}
+
+bool Debugger::breakpointHit(Chip8 & chip) {
+	unsigned short pc = chip.getPC() & 0xFFF;
+	for(unsigned int i = 0; i < breakpoints.size(); i ++) {
+		const Breakpoint & breakpoint = breakpoints[i];
+		if(breakpoint.address != pc) {
+			continue;
+		}
+
+		std::stringstream ss;
+		ss << std::hex << std::uppercase << "Breakpoint at 0x" << pc;
+		if(breakpoint.conditional) {
+			unsigned short value;
+			switch(breakpoint.reg) {
+			case DEBUG_I:
+				value = chip.getI();
+				break;
+			case DEBUG_SP:
+				value = chip.getSP();
+				break;
+			case DEBUG_DT:
+				value = chip.getDelayTimer();
+				break;
+			case DEBUG_ST:
+				value = chip.getSoundTimer();
+				break;
+			default:
+				value = chip.getV(breakpoint.reg);
+				break;
+			}
+
+			bool hit = false;
+			switch(breakpoint.compare) {
+			case COMPARE_EQUAL:
+				hit = value == breakpoint.value;
+				break;
+			case COMPARE_NOT_EQUAL:
+				hit = value != breakpoint.value;
+				break;
+			case COMPARE_LESS:
+				hit = value < breakpoint.value;
+				break;
+			case COMPARE_GREATER:
+				hit = value > breakpoint.value;
+				break;
+			}
+			if(!hit) {
+				continue;
+			}
+			ss << " when " << registerNames[breakpoint.reg] << " " << compareNames[breakpoint.compare] << " 0x" << breakpoint.value;
+		}
+		stopReason = ss.str();
+		return true;
+	}
+	return false;
+}
+
+void Debugger::memoryRead(unsigned short address, unsigned int length) {
+	memoryAccess(address, length, WATCH_READ);
+}
+
+void Debugger::memoryWrite(unsigned short address, unsigned int length) {
+	memoryAccess(address, length, WATCH_WRITE);
+}
+
+void Debugger::memoryAccess(unsigned short address, unsigned int length, unsigned char flag) {
+	for(unsigned int i = 0; i < length; i ++) {
+		unsigned int at = (address + i) & 0xFFF;
+		if(watch[at] & flag) {
+			std::stringstream ss;
+			ss << std::hex << std::uppercase << (flag == WATCH_READ ? "Read" : "Write") << " of 0x" << at;
+			stopReason = ss.str();
+			watchHit = true;
+			return;
+		}
+	}
+}
+
+
+// Inspection
+
+void Debugger::printRegisters(Chip8 & chip) {
+	std::stringstream ss;
+	ss << std::hex << std::uppercase << std::setfill('0');
+	for(unsigned int i = 0; i < 16; i ++) {
+		ss << 'V' << i << "=" << std::setw(2) << (unsigned int) chip.getV(i) << (i % 8 == 7 ? '\n' : ' ');
+	}
+	ss << "I=" << std::setw(3) << chip.getI() << " PC=" << std::setw(3) << chip.getPC() << " SP=" << chip.getSP();
+	ss << " DT=" << std::setw(2) << (unsigned int) chip.getDelayTimer() << " ST=" << std::setw(2) << (unsigned int) chip.getSoundTimer();
+	ss << " next=" << std::setw(4) << ((chip.readMemory(chip.getPC()) << 8) | chip.readMemory(chip.getPC() + 1)) << '\n';
+	std::cout << ss.str();
+}
+
+void Debugger::printCallStack(Chip8 & chip) {
+	std::stringstream ss;
+	ss << std::hex << std::uppercase << std::setfill('0');
+	ss << "#0 0x" << std::setw(3) << chip.getPC() << '\n';
+	unsigned int depth = chip.getSP() < 16 ? chip.getSP() : 16;
+	for(unsigned int i = depth; i > 0; i --) {
+		// the stack holds the address of the CALL, execution carries on after it
+		ss << '#' << (depth - i + 1) << " 0x" << std::setw(3) << (chip.getStack(i - 1) + 2) << '\n';
+	}
+	std::cout << ss.str();
+}
+
+void Debugger::printMemory(Chip8 & chip, unsigned short start, unsigned int length) {
+	std::stringstream ss;
+	ss << std::hex << std::uppercase << std::setfill('0');
+	for(unsigned int i = 0; i < length; i ++) {
+		if(i % 16 == 0) {
+			ss << std::setw(3) << ((start + i) & 0xFFF) << ':';
+		}
+		ss << ' ' << std::setw(2) << (unsigned int) chip.readMemory((start + i) & 0xFFF);
+		if(i % 16 == 15 || i == length - 1) {
+			ss << '\n';
+		}
+	}
+	std::cout << ss.str();
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Chip8.h"
+
+class TraceWriter;
+
+// Registers a conditional breakpoint can test
+enum DebugRegister {
+	DEBUG_V0 = 0x0, // DEBUG_V0 + n is Vn
+	DEBUG_VF = 0xF,
+	DEBUG_I,
+	DEBUG_SP,
+	DEBUG_DT,
+	DEBUG_ST
+};
+
+enum DebugCompare {
+	COMPARE_EQUAL,
+	COMPARE_NOT_EQUAL,
+	COMPARE_LESS,
+	COMPARE_GREATER
+};
+
+#define WATCH_READ 0x1
+#define WATCH_WRITE 0x2
+
+/*
+Breakpoints, watchpoints and inspection for a Chip8.
+Nothing here costs anything while a game runs through Chip8::cycle(), only step() goes through the checked
+Chip8::debugCycle() path, so the debugger can stay compiled in and only be used when it has something to watch.
+*/
+class Debugger {
+
+public:
+	Debugger();
+
+	// Stop before the instruction at address runs
+	void addBreakpoint(unsigned short address);
+	// Stop before the instruction at address runs, but only if reg compared to value is true
+	void addConditionalBreakpoint(unsigned short address, DebugRegister reg, DebugCompare compare, unsigned short value);
+	// Removes every breakpoint at address
+	void removeBreakpoint(unsigned short address);
+	// Stop after an instruction reads and or writes memory between start and end inclusive, flags is WATCH_READ and or WATCH_WRITE
+	void addWatchpoint(unsigned short start, unsigned short end, unsigned char flags);
+	void clearWatchpoints();
+
+	// Returns true if there are any breakpoints or watchpoints, otherwise Chip8::cycle() may as well be used
+	bool isActive();
+
+	// Runs one instruction unless a breakpoint stops it first. Returns false if execution stopped,
+	// stepping again runs the instruction that was stopped on
+	bool step(Chip8 & chip);
+	// Appends every instruction step() runs to trace as well, so a trace has no gaps while the debugger is in use. nullptr stops it
+	void setTrace(TraceWriter * trace);
+	// Returns why the last step() stopped
+	std::string getStopReason();
+
+	// Prints V0-VF, I, PC, SP and the timers
+	void printRegisters(Chip8 & chip);
+	// Prints the return addresses on the stack, innermost first
+	void printCallStack(Chip8 & chip);
+	// Prints length bytes of memory from start as hex, 16 a line
+	void printMemory(Chip8 & chip, unsigned short start, unsigned int length);
+
+	// Called by Chip8::debugCycle() when an instruction touches memory
+	void memoryRead(unsigned short address, unsigned int length);
+	void memoryWrite(unsigned short address, unsigned int length);
+
+private:
+
+	struct Breakpoint {
+		unsigned short address;
+		bool conditional;
+		DebugRegister reg;
+		DebugCompare compare;
+		unsigned short value;
+	};
+
+	// Checks the breakpoints at the current PC
+	bool breakpointHit(Chip8 & chip);
+	void memoryAccess(unsigned short address, unsigned int length, unsigned char flag);
+
+	std::vector<Breakpoint> breakpoints;
+	bool breakAt[4096]; // quick test for whether an address has any breakpoints
+	unsigned char watch[4096]; // WATCH_READ | WATCH_WRITE for each byte of memory
+	unsigned int watchpointCount;
+
+	bool stopped;
+	unsigned short stoppedAt; // the pc a breakpoint stopped on, so the next step runs it
+	bool watchHit;
+	std::string stopReason;
+	TraceWriter * trace;
+
+};
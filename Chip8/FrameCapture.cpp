@@ -0,0 +1,295 @@
+#include <SFML/Graphics.hpp>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include "FrameCapture.h"
+
+FrameCapture::FrameCapture(std::string fileName, unsigned int queueSize) {
+	this->fileName = fileName;
+	open = false;
+	haveLast = false;
+	submitted = 0;
+	head = 0;
+	count = 0;
+	stopping = false;
+	dropped = 0;
+	havePending = false;
+
+	std::string extension = fileName.size() > 4 ? fileName.substr(fileName.size() - 4) : "";
+	if(extension == ".png") {
+		format = CAPTURE_PNG;
+		this->fileName = fileName.substr(0, fileName.size() - 4); // frame numbers get added before the extension
+		open = true;
+	}
+	else if(extension == ".y4m" || extension == ".gif") {
+		format = extension == ".y4m" ? CAPTURE_Y4M : CAPTURE_GIF;
+		output.open(fileName, std::ios::binary);
+		open = output.is_open();
+	}
+
+	if(!open) {
+		std::cout << "Error: can't record to " << fileName << ", use a .png, .y4m or .gif file" << std::endl;
+		return;
+	}
+
+	if(format == CAPTURE_Y4M) {
+		writeY4mHeader();
+	}
+	else if(format == CAPTURE_GIF) {
+		writeGifHeader();
+	}
+
+	queue.resize(queueSize > 0 ? queueSize : 1);
+	worker = std::thread(&FrameCapture::run, this);
+}
+
+FrameCapture::~FrameCapture() {
+	stop();
+}
+
+bool FrameCapture::isOpen() {
+	return open;
+}
+
+void FrameCapture::submit(const unsigned long long * rows, unsigned int height) {
+	if(!open) {
+		return;
+	}
+	unsigned long long number = submitted ++;
+
+	if(height > GFX_HEIGHT) {
+		height = GFX_HEIGHT;
+	}
+	if(haveLast && memcmp(last.rows, rows, height * sizeof(unsigned long long)) == 0) {
+		return; // nothing has changed since the last frame we queued
+	}
+	last.number = number;
+	memcpy(last.rows, rows, height * sizeof(unsigned long long));
+	haveLast = true;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(count == queue.size()) {
+			// the encoder can't keep up, lose the frame rather than stall emulation
+			dropped ++;
+			haveLast = false; // so the next frame is compared against what was actually queued
+			return;
+		}
+		queue[(head + count) % queue.size()] = last;
+		count ++;
+	}
+	ready.notify_one();
+}
+
+void FrameCapture::stop() {
+	if(!worker.joinable()) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	ready.notify_one();
+	worker.join();
+
+	// the last frame is shown until recording stopped
+	if(havePending) {
+		encode(pending, submitted > pending.number ? submitted : pending.number + 1);
+		havePending = false;
+	}
+	if(format == CAPTURE_GIF) {
+		writeGifTrailer();
+	}
+	if(output.is_open()) {
+		output.close();
+	}
+}
+
+unsigned long long FrameCapture::getFramesSubmitted() {
+	return submitted;
+}
+
+unsigned long long FrameCapture::getFramesDropped() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return dropped;
+}
+
+void FrameCapture::run() {
+	Frame frame;
+	while(true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while(count == 0 && !stopping) {
+				ready.wait(lock);
+			}
+			if(count == 0) {
+				return; // stopping and everything has been written
+			}
+			frame = queue[head];
+			head = (head + 1) % queue.size();
+			count --;
+		}
+
+		// video formats need to know how long a frame is on screen, so each one is written when the next arrives
+		if(havePending) {
+			encode(pending, frame.number);
+		}
+		pending = frame;
+		havePending = true;
+	}
+}
+
+void FrameCapture::encode(const Frame & frame, unsigned long long end) {
+	switch(format) {
+	case CAPTURE_PNG:
+		writePng(frame);
+		break;
+	case CAPTURE_Y4M:
+		writeY4m(frame, end - frame.number);
+		break;
+	case CAPTURE_GIF:
+		writeGif(frame, end);
+		break;
+	}
+}
+
+
+// PNG sequence
+
+void FrameCapture::writePng(const Frame & frame) {
+	sf::Image image;
+	image.create(GFX_WIDTH, GFX_HEIGHT, sf::Color::Black);
+	for(unsigned int y = 0; y < GFX_HEIGHT; y ++) {
+		for(unsigned int x = 0; x < GFX_WIDTH; x ++) {
+			if((frame.rows[y] >> (63 - x)) & 0x1) {
+				image.setPixel(x, y, sf::Color::White);
+			}
+		}
+	}
+	std::stringstream name;
+	name << fileName << '_' << std::setw(6) << std::setfill('0') << frame.number << ".png";
+	image.saveToFile(name.str());
+}
+
+
+// YUV4MPEG2, full resolution chroma so no pixel is blurred
+
+void FrameCapture::writeY4mHeader() {
+	output << "YUV4MPEG2 W" << GFX_WIDTH << " H" << GFX_HEIGHT << " F60:1 Ip A1:1 C444\n";
+}
+
+void FrameCapture::writeY4m(const Frame & frame, unsigned long long repeat) {
+	static const unsigned int planeSize = GFX_WIDTH * GFX_HEIGHT;
+	unsigned char planes[planeSize * 3];
+	for(unsigned int y = 0; y < GFX_HEIGHT; y ++) {
+		for(unsigned int x = 0; x < GFX_WIDTH; x ++) {
+			planes[x + (GFX_WIDTH * y)] = ((frame.rows[y] >> (63 - x)) & 0x1) ? 235 : 16; // video range luma
+		}
+	}
+	memset(planes + planeSize, 128, planeSize * 2); // no colour
+
+	// Y4M has a fixed frame rate so frames that were skipped as unchanged are written out again here
+	for(unsigned long long i = 0; i < repeat; i ++) {
+		output << "FRAME\n";
+		output.write((const char *) planes, sizeof(planes));
+	}
+}
+
+
+// GIF89a with a two colour palette
+
+void FrameCapture::writeGifHeader() {
+	static const unsigned char header[] = {
+		'G', 'I', 'F', '8', '9', 'a',
+		GFX_WIDTH, 0, GFX_HEIGHT, 0, // logical screen size, little endian
+		0x80, 0, 0, // global colour table of 2 entries, background colour 0, square pixels
+		0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, // black, white
+		0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0', 0x03, 0x01, 0x00, 0x00, 0x00 // loop forever
+	};
+	output.write((const char *) header, sizeof(header));
+	lzwTable.resize(4096 * 4);
+}
+
+void FrameCapture::writeGif(const Frame & frame, unsigned long long end) {
+	// delays are in hundredths of a second, work them out from the total so rounding doesn't drift
+	unsigned int delay = (unsigned int) (((end * 100 + 30) / 60) - ((frame.number * 100 + 30) / 60));
+	if(delay > 0xFFFF) {
+		delay = 0xFFFF;
+	}
+	const unsigned char control[] = {
+		0x21, 0xF9, 0x04, 0x00, (unsigned char) (delay & 0xFF), (unsigned char) (delay >> 8), 0x00, 0x00, // graphic control
+		0x2C, 0, 0, 0, 0, GFX_WIDTH, 0, GFX_HEIGHT, 0, 0x00, // image descriptor covering the whole screen
+		0x02 // LZW minimum code size, GIF doesn't allow less than 2 even for 2 colours
+	};
+	output.write((const char *) control, sizeof(control));
+
+	// LZW compress the pixels, codes are packed least significant bit first into blocks of up to 255 bytes
+	static const unsigned int clearCode = 4;
+	static const unsigned int endCode = 5;
+	unsigned char block[256];
+	unsigned int blockSize = 0;
+	unsigned long bits = 0;
+	unsigned int bitCount = 0;
+	unsigned int codeSize = 3;
+	unsigned int nextCode = endCode + 1;
+
+	// lzwTable[code * 4 + pixel] is the code for code followed by pixel, or 0 if there isn't one yet
+	std::fill(lzwTable.begin(), lzwTable.end(), 0);
+
+	#define GIF_OUTPUT(code) \
+		bits |= (unsigned long) (code) << bitCount; \
+		bitCount += codeSize; \
+		while(bitCount >= 8) { \
+			block[1 + blockSize ++] = (unsigned char) (bits & 0xFF); \
+			bits >>= 8; \
+			bitCount -= 8; \
+			if(blockSize == 255) { \
+				block[0] = 255; \
+				output.write((const char *) block, 256); \
+				blockSize = 0; \
+			} \
+		} \
+		if(nextCode >= (1u << codeSize) && codeSize < 12) { \
+			codeSize ++; \
+		}
+
+	GIF_OUTPUT(clearCode);
+	unsigned int prefix = (unsigned int) (frame.rows[0] >> 63);
+	for(unsigned int i = 1; i < GFX_WIDTH * GFX_HEIGHT; i ++) {
+		unsigned int pixel = (unsigned int) ((frame.rows[i / GFX_WIDTH] >> (63 - (i % GFX_WIDTH))) & 0x1);
+		unsigned short found = lzwTable[prefix * 4 + pixel];
+		if(found != 0) {
+			prefix = found;
+			continue;
+		}
+		GIF_OUTPUT(prefix);
+		if(nextCode >= 4095) {
+			// the table is full, start again
+			GIF_OUTPUT(clearCode);
+			std::fill(lzwTable.begin(), lzwTable.end(), 0);
+			codeSize = 3;
+			nextCode = endCode + 1;
+		}
+		else {
+			lzwTable[prefix * 4 + pixel] = (unsigned short) nextCode ++;
+		}
+		prefix = pixel;
+	}
+	GIF_OUTPUT(prefix);
+	GIF_OUTPUT(endCode);
+	#undef GIF_OUTPUT
+
+	if(bitCount > 0) {
+		block[1 + blockSize ++] = (unsigned char) (bits & 0xFF);
+	}
+	if(blockSize > 0) {
+		block[0] = (unsigned char) blockSize;
+		output.write((const char *) block, blockSize + 1);
+	}
+	output.put(0); // end of image data
+}
+
+void FrameCapture::writeGifTrailer() {
+	output.put(0x3B);
+}
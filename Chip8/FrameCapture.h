@@ -0,0 +1,93 @@
+#pragma once
+#include <string>
+#include <fstream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "Chip8.h"
+
+// The kind of file a FrameCapture writes, picked from the extension of the file name
+enum CaptureFormat {
+	CAPTURE_PNG, // one lossless png per changed frame, name_000042.png
+	CAPTURE_Y4M, // raw YUV4MPEG2 video at 60 frames a second
+	CAPTURE_GIF  // looping animated gif
+};
+
+/*
+Records the display to disk without slowing down emulation.
+submit() is called once per emulated frame, it skips frames that are the same as the last one
+and hands the rest to a background thread through a fixed size queue. If the encoder falls behind
+frames are dropped and counted rather than making the emulator wait.
+*/
+class FrameCapture {
+
+public:
+	// Opens fileName for writing, queueSize is how many changed frames can be waiting to be encoded
+	FrameCapture(std::string fileName, unsigned int queueSize = 64);
+	// Finishes writing anything still queued and closes the file
+	~FrameCapture();
+
+	// Returns false if the file couldn't be created or the extension isn't a known format
+	bool isOpen();
+
+	// Queues the display for encoding, rows is height packed rows as returned by Chip8::getPackedGraphics()
+	void submit(const unsigned long long * rows, unsigned int height);
+
+	// Waits for the encoder to write everything queued then closes the file, called by the destructor
+	void stop();
+
+	// Returns the number of frames submitted, including unchanged ones
+	unsigned long long getFramesSubmitted();
+	// Returns the number of frames lost because the queue was full
+	unsigned long long getFramesDropped();
+
+private:
+
+	FrameCapture(const FrameCapture & other);
+	FrameCapture & operator=(const FrameCapture & other);
+
+	struct Frame {
+		unsigned long long number; // which emulated frame this is, gaps are frames that didn't change
+		unsigned long long rows[GFX_HEIGHT];
+	};
+
+	// Body of the encoder thread
+	void run();
+	// Writes frame, which is shown until frame number end
+	void encode(const Frame & frame, unsigned long long end);
+
+	void writePng(const Frame & frame);
+	void writeY4mHeader();
+	void writeY4m(const Frame & frame, unsigned long long repeat);
+	void writeGifHeader();
+	void writeGif(const Frame & frame, unsigned long long end);
+	void writeGifTrailer();
+
+	CaptureFormat format;
+	std::string fileName;
+	std::ofstream output;
+	bool open;
+
+	// Producer side, only touched by the thread calling submit()
+	Frame last;
+	bool haveLast;
+	unsigned long long submitted;
+
+	// Shared between the two threads, guarded by mutex
+	std::vector<Frame> queue;
+	unsigned int head;
+	unsigned int count;
+	bool stopping;
+	unsigned long long dropped;
+	std::mutex mutex;
+	std::condition_variable ready;
+
+	// Consumer side, only touched by the encoder thread
+	Frame pending;
+	bool havePending;
+	std::vector<unsigned short> lzwTable;
+
+	std::thread worker;
+
+};
@@ -0,0 +1,418 @@
+#include <cstring>
+#ifdef _WIN32
+#include <winsock2.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <cerrno>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+#include "FrameStream.h"
+
+static const unsigned long long blankFrame[GFX_HEIGHT] = { 0 };
+
+void encodeDelta(const unsigned long long * base, const unsigned long long * current, sf::Packet & packet) {
+	unsigned int rowMask = 0;
+	unsigned char bytes[GFX_HEIGHT * 8];
+	unsigned int size = 0;
+
+	// XOR the changed rows against the base, most significant byte first so the bytes read left to right
+	for(unsigned int y = 0; y < GFX_HEIGHT; y ++) {
+		unsigned long long changed = base[y] ^ current[y];
+		if(changed != 0) {
+			rowMask |= 1u << y;
+			for(unsigned int b = 0; b < 8; b ++) {
+				bytes[size ++] = (unsigned char) (changed >> (56 - (b * 8)));
+			}
+		}
+	}
+	packet << (sf::Uint32) rowMask;
+
+	// most of a changed row is usually still zero, so squash the runs of zeros
+	unsigned char rle[GFX_HEIGHT * 8 * 2];
+	unsigned int length = 0;
+	unsigned int i = 0;
+	while(i < size) {
+		unsigned int run = 0;
+		if(bytes[i] == 0) {
+			while(i + run < size && bytes[i + run] == 0 && run < 128) {
+				run ++;
+			}
+			rle[length ++] = (unsigned char) (0x80 | (run - 1));
+		}
+		else {
+			// a lone zero is cheaper left in the literal than ending it, two or more start a run
+			while(i + run < size && run < 128 && !(bytes[i + run] == 0 && (i + run + 1 >= size || bytes[i + run + 1] == 0))) {
+				run ++;
+			}
+			rle[length ++] = (unsigned char) (run - 1);
+			memcpy(rle + length, bytes + i, run);
+			length += run;
+		}
+		i += run;
+	}
+	packet.append(rle, length);
+}
+
+bool decodeDelta(sf::Packet & packet, unsigned long long * frame) {
+	sf::Uint32 rowMask;
+	if(!(packet >> rowMask)) {
+		return false;
+	}
+
+	unsigned char bytes[GFX_HEIGHT * 8];
+	unsigned int size = 0;
+	for(unsigned int y = 0; y < GFX_HEIGHT; y ++) {
+		if(rowMask & (1u << y)) {
+			size += 8;
+		}
+	}
+
+	unsigned int i = 0;
+	while(i < size) {
+		sf::Uint8 token;
+		if(!(packet >> token)) {
+			return false;
+		}
+		unsigned int run = (token & 0x7F) + 1;
+		if(i + run > size) {
+			return false;
+		}
+		for(unsigned int j = 0; j < run; j ++) {
+			sf::Uint8 value = 0;
+			if(!(token & 0x80) && !(packet >> value)) {
+				return false;
+			}
+			bytes[i ++] = value;
+		}
+	}
+
+	i = 0;
+	for(unsigned int y = 0; y < GFX_HEIGHT; y ++) {
+		if(rowMask & (1u << y)) {
+			unsigned long long changed = 0;
+			for(unsigned int b = 0; b < 8; b ++) {
+				changed = (changed << 8) | bytes[i ++];
+			}
+			frame[y] ^= changed;
+		}
+	}
+	return true;
+}
+
+
+// Sockets
+
+bool LocalListener::listenLocal(unsigned short port) {
+	close();
+	create();
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(::bind(getHandle(), (sockaddr *) &address, sizeof(address)) != 0 || ::listen(getHandle(), SOMAXCONN) != 0) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool StreamSocket::queue(const sf::Packet & packet) {
+	size_t size = packet.getDataSize();
+	const unsigned char * data = (const unsigned char *) packet.getData();
+	pending.push_back((unsigned char) (size >> 24));
+	pending.push_back((unsigned char) (size >> 16));
+	pending.push_back((unsigned char) (size >> 8));
+	pending.push_back((unsigned char) size);
+	pending.insert(pending.end(), data, data + size);
+	return flush();
+}
+
+bool StreamSocket::flush() {
+	size_t done = 0;
+	while(done < pending.size()) {
+#ifdef _WIN32
+		int sent = ::send(getHandle(), (const char *) &pending[done], (int) (pending.size() - done), 0);
+		if(sent == SOCKET_ERROR) {
+			if(WSAGetLastError() != WSAEWOULDBLOCK) {
+				return false;
+			}
+			break;
+		}
+#else
+#ifdef MSG_NOSIGNAL
+		int sent = (int) ::send(getHandle(), &pending[done], pending.size() - done, MSG_NOSIGNAL);
+#else
+		int sent = (int) ::send(getHandle(), &pending[done], pending.size() - done, 0);
+#endif
+		if(sent < 0) {
+			if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				return false;
+			}
+			break;
+		}
+#endif
+		done += sent;
+	}
+	pending.erase(pending.begin(), pending.begin() + done);
+	return true;
+}
+
+size_t StreamSocket::getPending() {
+	return pending.size();
+}
+
+
+// Server
+
+StreamServer::StreamServer(unsigned short port) {
+	listener.setBlocking(false);
+	listening = listener.listenLocal(port);
+	if(!listening) {
+		std::cout << "Error: can't listen on port " << port << std::endl;
+	}
+	for(unsigned int i = 0; i < STREAM_HISTORY; i ++) {
+		history[i].number = 0;
+	}
+	frameNumber = 0;
+	bytesSent = 0;
+	framesSent = 0;
+}
+
+StreamServer::~StreamServer() {
+	for(unsigned int i = 0; i < clients.size(); i ++) {
+		clients[i].socket->disconnect();
+		delete clients[i].socket;
+	}
+	clients.clear();
+	listener.close();
+}
+
+bool StreamServer::isListening() {
+	return listening;
+}
+
+void StreamServer::poll(Chip8 & chip) {
+	if(!listening) {
+		return;
+	}
+
+	StreamSocket * socket = new StreamSocket();
+	while(listener.accept(*socket) == sf::Socket::Done) {
+		socket->setBlocking(false);
+		Client client;
+		client.socket = socket;
+		client.acked = 0;
+		client.sent = 0;
+		client.keys = 0;
+		clients.push_back(client);
+		std::cout << "Client connected" << std::endl;
+		socket = new StreamSocket();
+	}
+	delete socket;
+
+	unsigned short keys = 0;
+	for(unsigned int i = 0; i < clients.size(); i ++) {
+		Client & client = clients[i];
+		sf::Packet packet;
+		sf::Socket::Status status;
+		while((status = client.socket->receive(packet)) == sf::Socket::Done) {
+			sf::Uint8 type;
+			packet >> type;
+			if(type == 'A') {
+				sf::Uint32 number;
+				if(packet >> number) {
+					client.acked = number;
+				}
+			}
+			else if(type == 'K') {
+				sf::Uint16 mask;
+				if(packet >> mask) {
+					client.keys = mask;
+				}
+			}
+			packet.clear();
+		}
+		if(status == sf::Socket::Disconnected || status == sf::Socket::Error) {
+			std::cout << "Client disconnected" << std::endl;
+			delete client.socket;
+			clients.erase(clients.begin() + i);
+			i --;
+			continue;
+		}
+		keys |= client.keys;
+	}
+
+	for(unsigned int i = 0; i < 16; i ++) {
+		chip.setKeyState(i, (keys & (1 << i)) != 0);
+	}
+}
+
+void StreamServer::sendFrame(Chip8 & chip) {
+	const unsigned long long * rows = chip.getPackedGraphics();
+	if(frameNumber == 0 || memcmp(history[frameNumber % STREAM_HISTORY].rows, rows, sizeof(history[0].rows)) != 0) {
+		frameNumber ++;
+		Frame & frame = history[frameNumber % STREAM_HISTORY];
+		frame.number = frameNumber;
+		memcpy(frame.rows, rows, sizeof(frame.rows));
+	}
+
+	for(unsigned int i = 0; i < clients.size(); i ++) {
+		Client & client = clients[i];
+		bool ok = client.socket->flush();
+		// a client still reading the last frame skips this one and gets a delta against whatever it acknowledges later
+		if(ok && client.sent != frameNumber && client.socket->getPending() == 0) {
+			// fall back to a blank screen if the client's last frame has been forgotten
+			const Frame * base = findFrame(client.acked);
+			sf::Packet packet;
+			packet << (sf::Uint8) 'F' << (sf::Uint32) frameNumber << (sf::Uint32) (base != nullptr ? base->number : 0);
+			encodeDelta(base != nullptr ? base->rows : blankFrame, rows, packet);
+
+			ok = client.socket->queue(packet);
+			client.sent = frameNumber;
+			bytesSent += packet.getDataSize() + 4; // plus the 32 bit size in front
+			framesSent ++;
+		}
+		if(!ok) {
+			std::cout << "Client disconnected" << std::endl;
+			delete client.socket;
+			clients.erase(clients.begin() + i);
+			i --;
+		}
+	}
+}
+
+const StreamServer::Frame * StreamServer::findFrame(unsigned int number) {
+	const Frame & frame = history[number % STREAM_HISTORY];
+	if(number == 0 || frame.number != number) {
+		return nullptr;
+	}
+	return &frame;
+}
+
+unsigned int StreamServer::getClientCount() {
+	return (unsigned int) clients.size();
+}
+
+unsigned long long StreamServer::getBytesSent() {
+	return bytesSent;
+}
+
+unsigned long long StreamServer::getFramesSent() {
+	return framesSent;
+}
+
+
+// Client
+
+StreamClient::StreamClient() {
+	connected = false;
+	for(unsigned int i = 0; i < STREAM_HISTORY; i ++) {
+		history[i].number = 0;
+	}
+	memset(rows, 0, sizeof(rows));
+	needsRedraw = true;
+	keys = 0;
+	keysSent = false;
+	bytesReceived = 0;
+	framesReceived = 0;
+}
+
+bool StreamClient::connect(std::string host, unsigned short port) {
+	connected = socket.connect(host, port, sf::seconds(5.f)) == sf::Socket::Done;
+	if(connected) {
+		socket.setBlocking(false);
+	}
+	else {
+		std::cout << "Error: can't connect to " << host << ":" << port << std::endl;
+	}
+	return connected;
+}
+
+bool StreamClient::isConnected() {
+	return connected;
+}
+
+void StreamClient::poll() {
+	if(!connected) {
+		return;
+	}
+
+	if(!socket.flush()) {
+		std::cout << "Disconnected from server" << std::endl;
+		connected = false;
+		return;
+	}
+
+	sf::Packet packet;
+	sf::Socket::Status status;
+	while((status = socket.receive(packet)) == sf::Socket::Done) {
+		bytesReceived += packet.getDataSize() + 4;
+		sf::Uint8 type;
+		sf::Uint32 number;
+		sf::Uint32 baseNumber;
+		if(!(packet >> type >> number >> baseNumber) || type != 'F' || number == 0) {
+			packet.clear();
+			continue;
+		}
+
+		Frame & base = history[baseNumber % STREAM_HISTORY];
+		if(baseNumber != 0 && base.number != baseNumber) {
+			// we no longer have what the server diffed against, wait for a frame we can use
+			packet.clear();
+			continue;
+		}
+
+		Frame frame;
+		frame.number = number;
+		memcpy(frame.rows, baseNumber != 0 ? base.rows : blankFrame, sizeof(frame.rows));
+		if(decodeDelta(packet, frame.rows)) {
+			history[number % STREAM_HISTORY] = frame;
+			memcpy(rows, frame.rows, sizeof(rows));
+			needsRedraw = true;
+			framesReceived ++;
+
+			sf::Packet ack;
+			ack << (sf::Uint8) 'A' << number;
+			socket.queue(ack);
+		}
+		packet.clear();
+	}
+	if(status == sf::Socket::Disconnected || status == sf::Socket::Error) {
+		std::cout << "Disconnected from server" << std::endl;
+		connected = false;
+	}
+}
+
+void StreamClient::setKeys(unsigned short keys) {
+	if(!connected || (keysSent && keys == this->keys)) {
+		return;
+	}
+	sf::Packet packet;
+	packet << (sf::Uint8) 'K' << (sf::Uint16) keys;
+	socket.queue(packet);
+	this->keys = keys;
+	keysSent = true;
+}
+
+bool StreamClient::getNeedRedraw() {
+	return needsRedraw;
+}
+
+void StreamClient::setNeedRedraw(bool set) {
+	needsRedraw = set;
+}
+
+const unsigned long long * StreamClient::getPackedGraphics() {
+	return rows;
+}
+
+unsigned long long StreamClient::getBytesReceived() {
+	return bytesReceived;
+}
+
+unsigned long long StreamClient::getFramesReceived() {
+	return framesReceived;
+}
@@ -0,0 +1,159 @@
+#pragma once
+#include <SFML/Network.hpp>
+#include <vector>
+#include "Chip8.h"
+
+/*
+Protocol
+--------
+Messages are laid out like sf::Packets over TCP, a big endian Uint32 size and then the data.
+
+Server to client:
+	'F' Uint32 number, Uint32 base, Uint32 rowMask, RLE bytes
+	A new display. Bit y of rowMask is set when row y differs from frame base, the RLE bytes are those rows
+	XORed with base, 8 bytes a row, top row first. Frame numbers start at 1, base 0 is a blank screen.
+
+Client to server:
+	'A' Uint32 number - the client has decoded frame number, the server may use it as a base from now on
+	'K' Uint16 keys   - bit n is set when key n is held down
+
+Deltas are always against a frame the client has acknowledged, so a dropped or late frame never corrupts the picture.
+
+RLE
+---
+A byte t with the top bit set is (t & 0x7F) + 1 zero bytes, otherwise it is followed by t + 1 literal bytes.
+*/
+
+// How many sent or received frames are remembered for use as a base
+#define STREAM_HISTORY 64
+
+// Appends the row mask and RLE bytes for the rows of current that differ from base to packet
+void encodeDelta(const unsigned long long * base, const unsigned long long * current, sf::Packet & packet);
+// Reads what encodeDelta wrote and applies it to frame, which should start as a copy of the base. Returns false if the packet is short
+bool decodeDelta(sf::Packet & packet, unsigned long long * frame);
+
+// A TcpListener that only accepts connections from this machine, SFML 2.1 always listens on every interface
+class LocalListener : public sf::TcpListener {
+
+public:
+	// Listens on 127.0.0.1, returns false if the port couldn't be opened
+	bool listenLocal(unsigned short port);
+
+};
+
+/*
+A TcpSocket that never loses part of a message. SFML 2.1 doesn't say how much of a non-blocking send went out,
+so a message cut short would leave the other end reading the rest of it as the start of the next one.
+Messages are queued here and whatever the socket won't take yet stays queued until the next flush().
+*/
+class StreamSocket : public sf::TcpSocket {
+
+public:
+	// Queues packet behind anything still unsent and sends as much as the socket will take. Returns false if the connection failed
+	bool queue(const sf::Packet & packet);
+	// Sends what it can of the queue, returns false if the connection failed
+	bool flush();
+	// Returns how many queued bytes haven't gone out yet
+	size_t getPending();
+
+private:
+
+	std::vector<unsigned char> pending;
+
+};
+
+// Serves a running Chip8 to clients on localhost
+class StreamServer {
+
+public:
+	StreamServer(unsigned short port);
+	~StreamServer();
+
+	// Returns false if the port couldn't be opened
+	bool isListening();
+
+	// Accepts new clients and applies their acknowledgements and key presses to chip, call once a frame
+	void poll(Chip8 & chip);
+	// Sends the display to every client if it has changed since the last call
+	void sendFrame(Chip8 & chip);
+
+	unsigned int getClientCount();
+	// Returns the total bytes of frame data sent, not counting TCP overhead
+	unsigned long long getBytesSent();
+	unsigned long long getFramesSent();
+
+private:
+
+	StreamServer(const StreamServer & other);
+	StreamServer & operator=(const StreamServer & other);
+
+	struct Client {
+		StreamSocket * socket;
+		unsigned int acked; // last frame the client confirmed, 0 if none
+		unsigned int sent; // last frame sent to the client, 0 if none
+		unsigned short keys;
+	};
+
+	struct Frame {
+		unsigned int number;
+		unsigned long long rows[GFX_HEIGHT];
+	};
+
+	// Returns the remembered frame with this number, or nullptr if it has been forgotten
+	const Frame * findFrame(unsigned int number);
+
+	LocalListener listener;
+	bool listening;
+	std::vector<Client> clients;
+	Frame history[STREAM_HISTORY];
+	unsigned int frameNumber;
+	unsigned long long bytesSent;
+	unsigned long long framesSent;
+
+};
+
+// Connects to a StreamServer and keeps a copy of its display
+class StreamClient {
+
+public:
+	StreamClient();
+
+	// Connects to a server on host, returns false if it couldn't
+	bool connect(std::string host, unsigned short port);
+	bool isConnected();
+
+	// Reads any frames the server has sent and acknowledges them
+	void poll();
+	// Tells the server which keys are held down, only sends anything if they changed
+	void setKeys(unsigned short keys);
+
+	// Check if a new frame has arrived
+	bool getNeedRedraw();
+	void setNeedRedraw(bool set);
+	// Returns the display as GFX_HEIGHT packed rows, like Chip8::getPackedGraphics()
+	const unsigned long long * getPackedGraphics();
+	// Returns the total bytes of frame data received
+	unsigned long long getBytesReceived();
+	unsigned long long getFramesReceived();
+
+private:
+
+	StreamClient(const StreamClient & other);
+	StreamClient & operator=(const StreamClient & other);
+
+	struct Frame {
+		unsigned int number;
+		unsigned long long rows[GFX_HEIGHT];
+	};
+
+	StreamSocket socket;
+	bool connected;
+	Frame history[STREAM_HISTORY];
+	unsigned long long rows[GFX_HEIGHT];
+	bool needsRedraw;
+	unsigned short keys;
+	bool keysSent;
+	unsigned long long bytesReceived;
+	unsigned long long framesReceived;
+
+};
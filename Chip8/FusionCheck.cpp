@@ -0,0 +1,207 @@
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include "FusionCheck.h"
+
+// Instructions in each generated program, which sits between 0x200 and 0x2FF so FX33 and FX55 can write above it
+#define CHECK_PROGRAM_LENGTH 128
+// Cycles each program is run for
+#define CHECK_CYCLES 2000
+
+// Same generator as CXKK, the program built from a seed doesn't depend on the platform's rand()
+static unsigned int nextRandom(unsigned int & state) {
+	state = state * 1664525 + 1013904223;
+	return state >> 8;
+}
+
+/*
+Fills program with instructions, mostly the sequences executeFused() looks for with their operands picked at random,
+so some of them are fused and some aren't, mixed with other instructions that change what they test.
+Jumps only land on the start of a piece and skips only ever skip the jump after them, nothing calls or returns,
+memory is only written above the program and the last instruction jumps back to the start,
+so every program runs for as long as it is asked to.
+*/
+static void generateProgram(unsigned short * program, unsigned int & state) {
+	// where each piece starts, and the jumps still to be pointed at one of them
+	unsigned int starts[CHECK_PROGRAM_LENGTH];
+	unsigned int pieces = 0;
+	bool needsTarget[CHECK_PROGRAM_LENGTH];
+	unsigned int length = 0;
+	while(length < CHECK_PROGRAM_LENGTH - 1) {
+		unsigned int x = nextRandom(state) % 16;
+		unsigned int y = nextRandom(state) % 16;
+		unsigned int kk = nextRandom(state) % 4 == 0 ? 0 : nextRandom(state) % 256;
+		// a jump to 0x000 is given a piece to land on once they are all placed
+		unsigned int target = 0;
+		unsigned short piece[3];
+		unsigned int size = 0;
+
+		switch(nextRandom(state) % 12) {
+		case 0:
+			piece[size ++] = (unsigned short) (0x6000 | x << 8 | kk);
+			piece[size ++] = (unsigned short) (0x6000 | y << 8 | (nextRandom(state) % 256));
+			break;
+		case 1:
+			piece[size ++] = (unsigned short) (0x3000 | x << 8 | kk);
+			piece[size ++] = (unsigned short) (0x1000 | target);
+			break;
+		case 2:
+			piece[size ++] = (unsigned short) (0x4000 | x << 8 | kk);
+			piece[size ++] = (unsigned short) (0x1000 | target);
+			break;
+		case 3:
+			piece[size ++] = (unsigned short) (0xE0A1 | x << 8);
+			piece[size ++] = (unsigned short) (0x1000 | target);
+			break;
+		case 4:
+			piece[size ++] = (unsigned short) (0xA000 | (nextRandom(state) % 0x300));
+			piece[size ++] = (unsigned short) (0xD000 | x << 8 | y << 4 | (nextRandom(state) % 16));
+			break;
+		case 5:
+			// a delay timer poll, jumping back to itself or somewhere else
+			piece[size ++] = (unsigned short) (0xF007 | x << 8);
+			piece[size ++] = (unsigned short) (0x3000 | x << 8);
+			piece[size ++] = (unsigned short) (0x1000 | (nextRandom(state) % 2 == 0 ? 0x200 + length * 2 : target));
+			break;
+		case 6:
+			piece[size ++] = (unsigned short) ((nextRandom(state) % 2 == 0 ? 0x6000 : 0x7000) | x << 8 | kk);
+			break;
+		case 7: {
+			static const unsigned short alu[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0xE };
+			piece[size ++] = (unsigned short) (0x8000 | x << 8 | y << 4 | alu[nextRandom(state) % 8]);
+			break;}
+		case 8: {
+			static const unsigned short timers[] = { 0x15, 0x18, 0x1E };
+			piece[size ++] = (unsigned short) (0xF000 | x << 8 | timers[nextRandom(state) % 3]);
+			break;}
+		case 9: {
+			static const unsigned short stores[] = { 0x33, 0x55, 0x65 };
+			piece[size ++] = (unsigned short) (0xA300 | (nextRandom(state) % 256));
+			piece[size ++] = (unsigned short) (0xF000 | x << 8 | stores[nextRandom(state) % 3]);
+			break;}
+		case 10:
+			piece[size ++] = (unsigned short) (0xC000 | x << 8 | kk);
+			break;
+		default:
+			piece[size ++] = (unsigned short) (0xE09E | x << 8);
+			piece[size ++] = (unsigned short) (0x1000 | target);
+			break;
+		}
+
+		// a piece that doesn't fit is left out rather than cut short, so a skip never lands past the end
+		if(length + size > CHECK_PROGRAM_LENGTH - 1) {
+			piece[0] = (unsigned short) (0x7000 | x << 8 | kk);
+			size = 1;
+		}
+		starts[pieces ++] = length;
+		for(unsigned int i = 0; i < size; i ++) {
+			needsTarget[length] = piece[i] == 0x1000;
+			program[length ++] = piece[i];
+		}
+	}
+	program[length] = 0x1200;
+
+	for(unsigned int i = 0; i < length; i ++) {
+		if(needsTarget[i]) {
+			program[i] = (unsigned short) (0x1000 | (0x200 + starts[nextRandom(state) % pieces] * 2));
+		}
+	}
+}
+
+// Compares everything an instruction can change, describing the first difference in what
+static bool sameState(Chip8 & expected, Chip8 & actual, std::string & what) {
+	std::stringstream ss;
+	ss << std::hex;
+	if(expected.getPC() != actual.getPC() || expected.getOpcode() != actual.getOpcode() || expected.getI() != actual.getI()) {
+		ss << "PC " << expected.getPC() << " " << actual.getPC() << ", opcode " << expected.getOpcode() << " " << actual.getOpcode()
+			<< ", I " << expected.getI() << " " << actual.getI();
+	}
+	else if(expected.getDelayTimer() != actual.getDelayTimer() || expected.getSoundTimer() != actual.getSoundTimer()) {
+		ss << "timers " << (int) expected.getDelayTimer() << "/" << (int) expected.getSoundTimer()
+			<< " " << (int) actual.getDelayTimer() << "/" << (int) actual.getSoundTimer();
+	}
+	else if(expected.getSP() != actual.getSP()) {
+		ss << "SP " << expected.getSP() << " " << actual.getSP();
+	}
+	else if(expected.getSpritesDrawn() != actual.getSpritesDrawn() || expected.getNeedRedraw() != actual.getNeedRedraw()) {
+		ss << "sprites drawn " << expected.getSpritesDrawn() << " " << actual.getSpritesDrawn();
+	}
+	else if(memcmp(expected.getPackedGraphics(), actual.getPackedGraphics(), sizeof(unsigned long long) * GFX_HEIGHT) != 0) {
+		ss << "display";
+	}
+	else {
+		for(unsigned int i = 0; i < 16; i ++) {
+			if(expected.getV(i) != actual.getV(i)) {
+				ss << "V" << i << " " << (int) expected.getV(i) << " " << (int) actual.getV(i);
+				break;
+			}
+		}
+		for(unsigned int i = 0; i < 4096 && ss.str().empty(); i ++) {
+			if(expected.readMemory((unsigned short) i) != actual.readMemory((unsigned short) i)) {
+				ss << "memory at " << i << " " << (int) expected.readMemory((unsigned short) i) << " " << (int) actual.readMemory((unsigned short) i);
+			}
+		}
+	}
+	what = ss.str();
+	return what.empty();
+}
+
+unsigned int checkFusion(unsigned int programs, unsigned int seed) {
+	unsigned int state = seed;
+	unsigned int failures = 0;
+	for(unsigned int p = 0; p < programs; p ++) {
+		unsigned short program[CHECK_PROGRAM_LENGTH];
+		generateProgram(program, state);
+		unsigned char rom[CHECK_PROGRAM_LENGTH * 2];
+		for(unsigned int i = 0; i < CHECK_PROGRAM_LENGTH; i ++) {
+			rom[i * 2] = (unsigned char) (program[i] >> 8);
+			rom[i * 2 + 1] = (unsigned char) program[i];
+		}
+
+		// stepped one cycle at a time, run() on flat memory and run() on a fork's paged memory
+		Chip8 expected;
+		expected.loadRom(rom, sizeof(rom));
+		expected.setSeed(nextRandom(state));
+		Chip8 flat;
+		flat = expected;
+		Chip8 fork(expected);
+
+		std::string what;
+		const char * which = nullptr;
+		unsigned int cycles = 0;
+		while(cycles < CHECK_CYCLES) {
+			// the key state changes between batches and a batch can end part way through a sequence
+			unsigned int batch = 1 + nextRandom(state) % 24;
+			for(unsigned int k = 0; k < 16; k ++) {
+				bool pressed = nextRandom(state) % 4 == 0;
+				expected.setKeyState(k, pressed);
+				flat.setKeyState(k, pressed);
+				fork.setKeyState(k, pressed);
+			}
+			for(unsigned int i = 0; i < batch; i ++) {
+				expected.cycle();
+			}
+			flat.run(batch);
+			fork.run(batch);
+			cycles += batch;
+
+			if(!sameState(expected, flat, what)) {
+				which = "run()";
+			}
+			else if(!sameState(expected, fork, what)) {
+				which = "run() on a fork";
+			}
+			if(which != nullptr) {
+				break;
+			}
+		}
+
+		if(which != nullptr) {
+			if(failures == 0) {
+				std::cout << "Program " << p << ": " << which << " differs from cycle() after " << cycles << " cycles, " << what << std::endl;
+			}
+			failures ++;
+		}
+	}
+	return failures;
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include "Chip8.h"
+
+/*
+Checks that Chip8::run() behaves exactly like calling Chip8::cycle() the same number of times.
+Random programs built mostly out of the sequences run() fuses are run both ways, plain and as a fork,
+and the registers, stack, timers, memory and display are compared after every batch of cycles.
+Programs are generated from seed so a failure can be reproduced. Returns how many programs differed,
+printing what differed for the first of them.
+*/
+unsigned int checkFusion(unsigned int programs, unsigned int seed);
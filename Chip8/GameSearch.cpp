@@ -0,0 +1,131 @@
+#include <thread>
+#include "GameSearch.h"
+
+GameSearch::GameSearch(SearchScore score) {
+	this->score = score;
+	choices.push_back(0);
+	for(unsigned int i = 0; i < 16; i ++) {
+		choices.push_back((unsigned short) (1 << i));
+	}
+	depth = 3;
+	cyclesPerStep = 10;
+	threads = 0;
+	nextBranch = 0;
+	leaves = 0;
+}
+
+void GameSearch::setChoices(const std::vector<unsigned short> & choices) {
+	this->choices = choices;
+}
+
+void GameSearch::setDepth(unsigned int depth) {
+	this->depth = depth > 0 ? depth : 1;
+}
+
+void GameSearch::setCyclesPerStep(unsigned int cycles) {
+	cyclesPerStep = cycles;
+}
+
+void GameSearch::setThreads(unsigned int threads) {
+	this->threads = threads;
+}
+
+float GameSearch::search(const Chip8 & root, std::vector<unsigned short> & best) {
+	best.clear();
+	leaves = 0;
+	if(choices.empty()) {
+		return 0.f;
+	}
+
+	unsigned int count = threads > 0 ? threads : std::thread::hardware_concurrency();
+	if(count == 0) {
+		count = 1;
+	}
+	if(count > choices.size()) {
+		count = (unsigned int) choices.size();
+	}
+
+	nextBranch = 0;
+	std::vector<SearchResult> results(count);
+	std::vector<std::thread> workers;
+	for(unsigned int i = 0; i < count; i ++) {
+		workers.push_back(std::thread(&GameSearch::work, this, &root, &results[i]));
+	}
+
+	float bestScore = 0.f;
+	unsigned int bestBranch = 0;
+	bool found = false;
+	for(unsigned int i = 0; i < count; i ++) {
+		workers[i].join();
+		const SearchResult & result = results[i];
+		leaves += result.leaves;
+		if(!result.found) {
+			continue;
+		}
+		if(!found || result.score > bestScore || (result.score == bestScore && result.branch < bestBranch)) {
+			found = true;
+			bestScore = result.score;
+			bestBranch = result.branch;
+			best = result.inputs;
+		}
+	}
+	return bestScore;
+}
+
+unsigned long long GameSearch::getLeaves() {
+	return leaves;
+}
+
+void GameSearch::work(const Chip8 * root, SearchResult * result) {
+	result->found = false;
+	result->score = 0.f;
+	result->branch = 0;
+	result->leaves = 0;
+
+	// forks.get(level) is the state after level inputs. Forking root copies its memory if it isn't a fork itself,
+	// so that is done once and the other levels share the first one's pages
+	Chip8Arena forks(depth + 1);
+	forks.fork(*root);
+	for(unsigned int level = 1; level <= depth; level ++) {
+		forks.fork(*forks.get(0));
+	}
+
+	std::vector<unsigned short> inputs(depth);
+	while(true) {
+		// branches are handed out in order so a thread finds its best branch first on a tie
+		unsigned int branch = nextBranch ++;
+		if(branch >= choices.size()) {
+			break;
+		}
+		inputs[0] = choices[branch];
+		expand(forks, 1, inputs, branch, *result);
+	}
+}
+
+void GameSearch::expand(Chip8Arena & forks, unsigned int level, std::vector<unsigned short> & inputs, unsigned int branch, SearchResult & result) {
+	Chip8 & chip = *forks.get(level);
+	chip = *forks.get(level - 1);
+
+	unsigned short keys = inputs[level - 1];
+	for(unsigned int i = 0; i < 16; i ++) {
+		chip.setKeyState(i, (keys & (1 << i)) != 0);
+	}
+	chip.run(cyclesPerStep);
+
+	if(level == depth) {
+		float value = score(chip);
+		result.leaves ++;
+		if(!result.found || value > result.score) {
+			result.found = true;
+			result.score = value;
+			result.branch = branch;
+			result.inputs = inputs;
+		}
+		return;
+	}
+
+	for(unsigned int i = 0; i < choices.size(); i ++) {
+		inputs[level] = choices[i];
+		expand(forks, level + 1, inputs, branch, result);
+	}
+}
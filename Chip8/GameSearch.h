@@ -0,0 +1,68 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <functional>
+#include "Chip8.h"
+#include "Chip8Arena.h"
+
+// Scores the state a sequence of inputs ends in, higher is better. Called from several threads at once
+typedef std::function<float (Chip8 & chip)> SearchScore;
+
+/*
+Finds the best sequence of key presses to make from a game state by playing all of them out.
+A sequence is depth inputs, each picked from the list of choices and held down for a number of cycles,
+and the state at the end of each one is scored with a callback.
+The first input of the sequence is shared out between threads. Each thread walks the rest of the tree depth first
+with one fork per level held in its own Chip8Arena, and siblings reuse their parent's fork so moving between them
+only copies registers and whichever memory pages the last sibling wrote to.
+Every fork carries on from the random numbers of the state it was forked from, so a search of a game that uses CXKK is repeatable.
+*/
+class GameSearch {
+
+public:
+	GameSearch(SearchScore score);
+
+	// The key masks to try at each step, bit n set means key n is held. By default nothing held and each key on its own
+	void setChoices(const std::vector<unsigned short> & choices);
+	// How many inputs make up a sequence, at least 1
+	void setDepth(unsigned int depth);
+	// How many cycles each input is held for
+	void setCyclesPerStep(unsigned int cycles);
+	// How many threads to search with, 0 uses one per hardware thread
+	void setThreads(unsigned int threads);
+
+	// Scores every sequence starting from root, returns the best score and fills best with the inputs that got it.
+	// Ties go to the sequence that comes first in choice order. root must not be running while this is
+	float search(const Chip8 & root, std::vector<unsigned short> & best);
+	// Returns how many sequences the last search scored
+	unsigned long long getLeaves();
+
+private:
+
+	GameSearch(const GameSearch & other);
+	GameSearch & operator=(const GameSearch & other);
+
+	// The best sequence one thread has found
+	struct SearchResult {
+		bool found;
+		float score;
+		unsigned int branch; // which first input it started with, for breaking ties the same way every time
+		std::vector<unsigned short> inputs;
+		unsigned long long leaves;
+	};
+
+	// Body of each search thread
+	void work(const Chip8 * root, SearchResult * result);
+	// Plays inputs[level - 1] on a fork of level - 1 and carries on down the tree from there
+	void expand(Chip8Arena & forks, unsigned int level, std::vector<unsigned short> & inputs, unsigned int branch, SearchResult & result);
+
+	SearchScore score;
+	std::vector<unsigned short> choices;
+	unsigned int depth;
+	unsigned int cyclesPerStep;
+	unsigned int threads;
+
+	std::atomic<unsigned int> nextBranch; // the next first input a thread should take
+	unsigned long long leaves;
+
+};
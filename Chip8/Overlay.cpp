@@ -0,0 +1,128 @@
+#include "Overlay.h"
+#include "Upscaler.h"
+
+// Each character takes up a 4x6 cell, the glyph and a gap to its right and below
+#define GLYPH_WIDTH 4
+#define GLYPH_HEIGHT 6
+#define OVERLAY_BORDER 1
+
+#define OVERLAY_BACKGROUND ((unsigned int) 0xA0000000u) // black, mostly opaque
+#define OVERLAY_TEXT MAKE_COLOR(255, 255, 255)
+
+struct Glyph {
+	char c;
+	unsigned char rows[5]; // the top 3 bits of each row, like the Chip 8 font
+};
+
+static const Glyph glyphs[] = {
+	{ '0', { 0xE0, 0xA0, 0xA0, 0xA0, 0xE0 } },
+	{ '1', { 0x40, 0xC0, 0x40, 0x40, 0xE0 } },
+	{ '2', { 0xE0, 0x20, 0xE0, 0x80, 0xE0 } },
+	{ '3', { 0xE0, 0x20, 0xE0, 0x20, 0xE0 } },
+	{ '4', { 0xA0, 0xA0, 0xE0, 0x20, 0x20 } },
+	{ '5', { 0xE0, 0x80, 0xE0, 0x20, 0xE0 } },
+	{ '6', { 0xE0, 0x80, 0xE0, 0xA0, 0xE0 } },
+	{ '7', { 0xE0, 0x20, 0x20, 0x20, 0x20 } },
+	{ '8', { 0xE0, 0xA0, 0xE0, 0xA0, 0xE0 } },
+	{ '9', { 0xE0, 0xA0, 0xE0, 0x20, 0xE0 } },
+	{ 'A', { 0x40, 0xA0, 0xE0, 0xA0, 0xA0 } },
+	{ 'B', { 0xC0, 0xA0, 0xC0, 0xA0, 0xC0 } },
+	{ 'C', { 0x60, 0x80, 0x80, 0x80, 0x60 } },
+	{ 'D', { 0xC0, 0xA0, 0xA0, 0xA0, 0xC0 } },
+	{ 'E', { 0xE0, 0x80, 0xC0, 0x80, 0xE0 } },
+	{ 'F', { 0xE0, 0x80, 0xC0, 0x80, 0x80 } },
+	{ 'G', { 0x60, 0x80, 0xA0, 0xA0, 0x60 } },
+	{ 'H', { 0xA0, 0xA0, 0xE0, 0xA0, 0xA0 } },
+	{ 'I', { 0xE0, 0x40, 0x40, 0x40, 0xE0 } },
+	{ 'J', { 0x20, 0x20, 0x20, 0xA0, 0x40 } },
+	{ 'K', { 0xA0, 0xA0, 0xC0, 0xA0, 0xA0 } },
+	{ 'L', { 0x80, 0x80, 0x80, 0x80, 0xE0 } },
+	{ 'M', { 0xA0, 0xE0, 0xE0, 0xA0, 0xA0 } },
+	{ 'N', { 0xC0, 0xA0, 0xA0, 0xA0, 0xA0 } },
+	{ 'O', { 0x40, 0xA0, 0xA0, 0xA0, 0x40 } },
+	{ 'P', { 0xC0, 0xA0, 0xC0, 0x80, 0x80 } },
+	{ 'Q', { 0x40, 0xA0, 0xA0, 0xC0, 0x60 } },
+	{ 'R', { 0xC0, 0xA0, 0xC0, 0xA0, 0xA0 } },
+	{ 'S', { 0x60, 0x80, 0x40, 0x20, 0xC0 } },
+	{ 'T', { 0xE0, 0x40, 0x40, 0x40, 0x40 } },
+	{ 'U', { 0xA0, 0xA0, 0xA0, 0xA0, 0xE0 } },
+	{ 'V', { 0xA0, 0xA0, 0xA0, 0xA0, 0x40 } },
+	{ 'W', { 0xA0, 0xA0, 0xE0, 0xE0, 0xA0 } },
+	{ 'X', { 0xA0, 0xA0, 0x40, 0xA0, 0xA0 } },
+	{ 'Y', { 0xA0, 0xA0, 0x40, 0x40, 0x40 } },
+	{ 'Z', { 0xE0, 0x20, 0x40, 0x80, 0xE0 } },
+	{ '.', { 0x00, 0x00, 0x00, 0x00, 0x40 } },
+	{ '%', { 0xA0, 0x20, 0x40, 0x80, 0xA0 } },
+	{ '/', { 0x20, 0x20, 0x40, 0x80, 0x80 } },
+	{ ':', { 0x00, 0x40, 0x00, 0x40, 0x00 } },
+	{ '-', { 0x00, 0x00, 0xE0, 0x00, 0x00 } }
+};
+
+Overlay::Overlay() {
+	width = 0;
+	height = 0;
+	setText("");
+}
+
+void Overlay::setText(std::string text) {
+	// measure it first
+	unsigned int lines = 1;
+	unsigned int longest = 0;
+	unsigned int length = 0;
+	for(unsigned int i = 0; i < text.size(); i ++) {
+		if(text[i] == '\n') {
+			lines ++;
+			length = 0;
+		}
+		else if(++ length > longest) {
+			longest = length;
+		}
+	}
+
+	width = longest * GLYPH_WIDTH + OVERLAY_BORDER * 2 - 1;
+	height = lines * GLYPH_HEIGHT + OVERLAY_BORDER * 2 - 1;
+	pixels.assign(width * height, OVERLAY_BACKGROUND);
+
+	unsigned int column = 0;
+	unsigned int line = 0;
+	for(unsigned int i = 0; i < text.size(); i ++) {
+		if(text[i] == '\n') {
+			line ++;
+			column = 0;
+			continue;
+		}
+		drawGlyph(text[i], OVERLAY_BORDER + column * GLYPH_WIDTH, OVERLAY_BORDER + line * GLYPH_HEIGHT);
+		column ++;
+	}
+}
+
+void Overlay::drawGlyph(char c, unsigned int left, unsigned int top) {
+	if(c >= 'a' && c <= 'z') {
+		c = c - 'a' + 'A';
+	}
+	for(unsigned int g = 0; g < sizeof(glyphs) / sizeof(glyphs[0]); g ++) {
+		if(glyphs[g].c != c) {
+			continue;
+		}
+		for(unsigned int y = 0; y < 5; y ++) {
+			for(unsigned int x = 0; x < 3; x ++) {
+				if(glyphs[g].rows[y] & (0x80 >> x)) {
+					pixels[(top + y) * width + left + x] = OVERLAY_TEXT;
+				}
+			}
+		}
+		return;
+	}
+}
+
+unsigned int Overlay::getWidth() {
+	return width;
+}
+
+unsigned int Overlay::getHeight() {
+	return height;
+}
+
+const unsigned char * Overlay::getPixels() {
+	return (const unsigned char *) &pixels[0];
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+#include <vector>
+
+/*
+Draws lines of text with a tiny built in 3x5 pixel font onto a see through dark box, as RGBA pixels ready for a texture.
+This saves shipping a font file just for the telemetry overlay. Only digits, upper case letters and . % / : - are known,
+anything else is left blank.
+*/
+class Overlay {
+
+public:
+	Overlay();
+
+	// Redraws the box to fit text, lines are split on '\n'
+	void setText(std::string text);
+
+	unsigned int getWidth();
+	unsigned int getHeight();
+	// Returns getWidth() * getHeight() RGBA pixels
+	const unsigned char * getPixels();
+
+private:
+
+	void drawGlyph(char c, unsigned int left, unsigned int top);
+
+	unsigned int width;
+	unsigned int height;
+	std::vector<unsigned int> pixels;
+
+};
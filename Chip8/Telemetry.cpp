@@ -0,0 +1,248 @@
+#include <sstream>
+#include <iomanip>
+#include <fstream>
+#include <cstdio>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include "Telemetry.h"
+
+static const char * phaseNames[TELEMETRY_PHASES] = { "emulation", "render", "sleep", "other" };
+
+// Quantiles reported in the metrics file
+static const float quantiles[] = { 0.5f, 0.9f, 0.99f, 1.f };
+
+Telemetry::Telemetry() {
+	phase = TELEMETRY_OTHER;
+	phaseStart = 0;
+	frameStart = 0;
+	intervalStart = 0;
+
+	for(unsigned int i = 0; i < TELEMETRY_PHASES; i ++) {
+		phaseTime[i] = 0;
+		phaseTotal[i] = 0;
+		phaseShare[i] = 0.f;
+	}
+	for(unsigned int i = 0; i < TELEMETRY_BUCKETS; i ++) {
+		histogram[i] = 0;
+		frameHistogram[i] = 0;
+	}
+	hostFrames = 0;
+	slowestFrame = 0;
+	instructions = 0;
+	frames = 0;
+	draws = 0;
+	sprites = 0;
+	lastSprites = 0;
+
+	hostFrameTotal = 0;
+	hostFrameCount = 0;
+	instructionTotal = 0;
+
+	instructionsPerSecond = 0.f;
+	framesPerSecond = 0.f;
+	drawsPerSecond = 0.f;
+	spritesPerFrame = 0.f;
+	frameCount = 0;
+	frameMax = 0;
+
+	clock.restart();
+}
+
+bool Telemetry::openMetrics(std::string fileName) {
+	metricsFile = fileName;
+	if(!writeMetrics()) {
+		std::cout << "Error: can't write metrics to " << fileName << std::endl;
+		metricsFile.clear();
+		return false;
+	}
+	return true;
+}
+
+void Telemetry::enterPhase(TelemetryPhase phase) {
+	long long now = clock.getElapsedTime().asMicroseconds();
+	phaseTime[this->phase] += now - phaseStart;
+	phaseStart = now;
+	this->phase = phase;
+}
+
+bool Telemetry::endFrame(Chip8 & chip, unsigned int cycles, bool drawn) {
+	enterPhase(TELEMETRY_OTHER);
+	long long now = phaseStart;
+
+	long long frameTime = now - frameStart;
+	frameStart = now;
+	unsigned int bucket = (unsigned int) (frameTime / TELEMETRY_BUCKET_WIDTH);
+	histogram[bucket < TELEMETRY_BUCKETS ? bucket : TELEMETRY_BUCKETS - 1] ++;
+	hostFrames ++;
+	if(frameTime > slowestFrame) {
+		slowestFrame = frameTime;
+	}
+	hostFrameTotal += frameTime;
+	hostFrameCount ++;
+
+	instructions += cycles;
+	if(cycles > 0) {
+		frames ++;
+	}
+	if(drawn) {
+		draws ++;
+	}
+	// the counter wraps, unsigned subtraction still gives the right difference
+	unsigned int drawnSoFar = chip.getSpritesDrawn();
+	sprites += drawnSoFar - lastSprites;
+	lastSprites = drawnSoFar;
+
+	if(now - intervalStart < TELEMETRY_INTERVAL) {
+		return false;
+	}
+	finishInterval(now);
+	return true;
+}
+
+void Telemetry::finishInterval(long long now) {
+	float seconds = (now - intervalStart) / 1000000.f;
+	instructionsPerSecond = instructions / seconds;
+	framesPerSecond = frames / seconds;
+	drawsPerSecond = draws / seconds;
+	spritesPerFrame = frames > 0 ? (float) sprites / frames : 0.f;
+
+	long long total = 0;
+	for(unsigned int i = 0; i < TELEMETRY_PHASES; i ++) {
+		total += phaseTime[i];
+	}
+	for(unsigned int i = 0; i < TELEMETRY_PHASES; i ++) {
+		phaseShare[i] = total > 0 ? (float) phaseTime[i] / total : 0.f;
+		phaseTotal[i] += phaseTime[i];
+		phaseTime[i] = 0;
+	}
+
+	// keep this interval's frame times for getFrameTime() and start counting again
+	for(unsigned int i = 0; i < TELEMETRY_BUCKETS; i ++) {
+		frameHistogram[i] = histogram[i];
+		histogram[i] = 0;
+	}
+	frameCount = hostFrames;
+	frameMax = slowestFrame;
+	hostFrames = 0;
+	slowestFrame = 0;
+
+	instructionTotal += instructions;
+	instructions = 0;
+	frames = 0;
+	draws = 0;
+	sprites = 0;
+	intervalStart = now;
+
+	if(!metricsFile.empty()) {
+		writeMetrics();
+	}
+}
+
+float Telemetry::getInstructionsPerSecond() {
+	return instructionsPerSecond;
+}
+
+float Telemetry::getFramesPerSecond() {
+	return framesPerSecond;
+}
+
+float Telemetry::getDrawsPerSecond() {
+	return drawsPerSecond;
+}
+
+float Telemetry::getSpritesPerFrame() {
+	return spritesPerFrame;
+}
+
+float Telemetry::getFrameTime(float percentile) {
+	if(frameCount == 0) {
+		return 0.f;
+	}
+	if(percentile >= 1.f) {
+		return frameMax / 1000000.f;
+	}
+	// the upper edge of the bucket the percentile falls in, so this never under reports
+	unsigned int wanted = (unsigned int) (percentile * frameCount);
+	unsigned int seen = 0;
+	for(unsigned int i = 0; i < TELEMETRY_BUCKETS - 1; i ++) {
+		seen += frameHistogram[i];
+		if(seen > wanted) {
+			long long edge = (long long) (i + 1) * TELEMETRY_BUCKET_WIDTH;
+			return (edge < frameMax ? edge : frameMax) / 1000000.f;
+		}
+	}
+	return frameMax / 1000000.f;
+}
+
+float Telemetry::getPhaseShare(TelemetryPhase phase) {
+	return phaseShare[phase];
+}
+
+std::string Telemetry::getSummary() {
+	std::stringstream ss;
+	ss << std::fixed << std::setprecision(1);
+	ss << "HZ " << (unsigned int) (instructionsPerSecond + 0.5f) << '\n';
+	ss << "FPS " << framesPerSecond << " DRAWN " << drawsPerSecond << '\n';
+	ss << "FRAME MS P50 " << getFrameTime(0.5f) * 1000.f << " P99 " << getFrameTime(0.99f) * 1000.f << " MAX " << getFrameTime(1.f) * 1000.f << '\n';
+	ss << std::setprecision(0);
+	ss << "EMU " << phaseShare[TELEMETRY_EMULATION] * 100.f << "% RENDER " << phaseShare[TELEMETRY_RENDER] * 100.f << "% SLEEP " << phaseShare[TELEMETRY_SLEEP] * 100.f << "%\n";
+	ss << std::setprecision(2);
+	ss << "DXYN/FRAME " << spritesPerFrame;
+	return ss.str();
+}
+
+/*
+Writes the current value of every metric. There are no timestamps, the collector stamps the file when it reads it.
+A summary is used for frame times since the quantiles are already worked out here.
+*/
+bool Telemetry::writeMetrics() {
+	std::stringstream ss;
+	ss << "# HELP chip8_instructions_total Instructions emulated.\n";
+	ss << "# TYPE chip8_instructions_total counter\n";
+	ss << "chip8_instructions_total " << instructionTotal << '\n';
+
+	ss << "# HELP chip8_instructions_per_second Effective clock speed over the last interval.\n";
+	ss << "# TYPE chip8_instructions_per_second gauge\n";
+	ss << "chip8_instructions_per_second " << instructionsPerSecond << '\n';
+
+	ss << "# HELP chip8_frames_per_second Emulated 60ths of a second run per second of real time.\n";
+	ss << "# TYPE chip8_frames_per_second gauge\n";
+	ss << "chip8_frames_per_second " << framesPerSecond << '\n';
+
+	ss << "# HELP chip8_draws_per_second Times the display was redrawn per second.\n";
+	ss << "# TYPE chip8_draws_per_second gauge\n";
+	ss << "chip8_draws_per_second " << drawsPerSecond << '\n';
+
+	ss << "# HELP chip8_sprites_per_frame DXYN instructions per emulated frame.\n";
+	ss << "# TYPE chip8_sprites_per_frame gauge\n";
+	ss << "chip8_sprites_per_frame " << spritesPerFrame << '\n';
+
+	ss << "# HELP chip8_host_frame_seconds Time taken by each pass of the host loop.\n";
+	ss << "# TYPE chip8_host_frame_seconds summary\n";
+	for(unsigned int i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i ++) {
+		ss << "chip8_host_frame_seconds{quantile=\"" << quantiles[i] << "\"} " << getFrameTime(quantiles[i]) << '\n';
+	}
+	ss << "chip8_host_frame_seconds_sum " << hostFrameTotal / 1000000.0 << '\n';
+	ss << "chip8_host_frame_seconds_count " << hostFrameCount << '\n';
+
+	ss << "# HELP chip8_phase_seconds_total Time the host loop has spent in each phase.\n";
+	ss << "# TYPE chip8_phase_seconds_total counter\n";
+	for(unsigned int i = 0; i < TELEMETRY_PHASES; i ++) {
+		ss << "chip8_phase_seconds_total{phase=\"" << phaseNames[i] << "\"} " << phaseTotal[i] / 1000000.0 << '\n';
+	}
+
+	// write a temporary file and rename it so the metrics file is never seen half written
+	std::string temporary = metricsFile + ".tmp";
+	std::ofstream output(temporary, std::ios::out | std::ios::trunc);
+	output << ss.str();
+	output.close();
+	if(output.fail()) {
+		return false;
+	}
+#ifdef _WIN32
+	return MoveFileExA(temporary.c_str(), metricsFile.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return std::rename(temporary.c_str(), metricsFile.c_str()) == 0;
+#endif
+}
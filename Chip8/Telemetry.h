@@ -0,0 +1,101 @@
+#pragma once
+#include <string>
+#include <SFML/System.hpp>
+#include "Chip8.h"
+
+// Where the host loop is spending its time
+enum TelemetryPhase {
+	TELEMETRY_EMULATION, // running instructions and reading keys
+	TELEMETRY_RENDER,    // building and presenting the display
+	TELEMETRY_SLEEP,     // waiting for the next 60th of a second
+	TELEMETRY_OTHER,     // everything else, mostly window events
+	TELEMETRY_PHASES
+};
+
+// How often the rates are worked out and written to the metrics file, in microseconds
+#define TELEMETRY_INTERVAL 1000000
+// Host frame times are counted in buckets this many microseconds wide, anything slower than the last bucket goes in it
+#define TELEMETRY_BUCKET_WIDTH 100
+#define TELEMETRY_BUCKETS 1000
+
+/*
+Measures how fast the emulator is really running.
+The host loop marks which phase it is in with enterPhase() and calls endFrame() once per pass,
+every TELEMETRY_INTERVAL the counts are turned into rates and frame time percentiles for the overlay
+and, if a metrics file is set, written to it in the Prometheus text format.
+The file is replaced whole each time, so a reader such as node_exporter's textfile collector always sees one complete snapshot.
+Nothing here allocates after construction so it is cheap enough to leave on all the time.
+*/
+class Telemetry {
+
+public:
+	Telemetry();
+
+	// Writes metrics to fileName now and every interval after, returns false if it can't be written
+	bool openMetrics(std::string fileName);
+
+	// Charges the time since the last call to the phase that was running, the clock now counts towards phase
+	void enterPhase(TelemetryPhase phase);
+	// Ends a pass of the host loop that ran cycles instructions on chip and redrew the screen if drawn is true.
+	// Returns true when a new interval has finished and the numbers below have changed
+	bool endFrame(Chip8 & chip, unsigned int cycles, bool drawn);
+
+	// Rates over the last interval
+	float getInstructionsPerSecond();
+	// Passes of the host loop that ran the emulator, each of which is one 60th of a second of game time
+	float getFramesPerSecond();
+	float getDrawsPerSecond();
+	float getSpritesPerFrame();
+	// Host frame time in seconds that percentile of the frames in the last interval were faster than, 1 gives the slowest
+	float getFrameTime(float percentile);
+	// Fraction of the last interval spent in phase
+	float getPhaseShare(TelemetryPhase phase);
+
+	// The last interval as a few lines of upper case text for the overlay
+	std::string getSummary();
+
+private:
+
+	Telemetry(const Telemetry & other);
+	Telemetry & operator=(const Telemetry & other);
+
+	void finishInterval(long long now);
+	// Writes a snapshot next to the metrics file then renames it over the top, returns false if that failed
+	bool writeMetrics();
+
+	sf::Clock clock;
+	TelemetryPhase phase;
+	long long phaseStart; // all times are microseconds on clock
+	long long frameStart;
+	long long intervalStart;
+
+	// Counts for the interval in progress
+	long long phaseTime[TELEMETRY_PHASES];
+	unsigned int histogram[TELEMETRY_BUCKETS];
+	unsigned int hostFrames;
+	long long slowestFrame;
+	unsigned long long instructions;
+	unsigned int frames;
+	unsigned int draws;
+	unsigned int sprites;
+	unsigned int lastSprites; // Chip8::getSpritesDrawn() at the end of the last frame
+
+	// Totals since the start, for the Prometheus counters
+	long long phaseTotal[TELEMETRY_PHASES];
+	long long hostFrameTotal;
+	unsigned long long hostFrameCount;
+	unsigned long long instructionTotal;
+
+	// Results of the last finished interval
+	float instructionsPerSecond;
+	float framesPerSecond;
+	float drawsPerSecond;
+	float spritesPerFrame;
+	float phaseShare[TELEMETRY_PHASES];
+	unsigned int frameHistogram[TELEMETRY_BUCKETS];
+	unsigned int frameCount;
+	long long frameMax;
+
+	std::string metricsFile; // empty if metrics aren't being written
+
+};
@@ -0,0 +1,239 @@
+#include <SFML/System.hpp>
+#include "TerminalDisplay.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <conio.h>
+#else
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+// What to print for each combination of top and bottom pixel
+static const char * halfBlocks[4] = {
+	" ",            // neither
+	"\xE2\x96\x80", // top, U+2580
+	"\xE2\x96\x84", // bottom, U+2584
+	"\xE2\x96\x88"  // both, U+2588
+};
+
+// The keyboard layout from main.cpp, keys[n] is the character for keypad key n
+static const char keypadKeys[16] = { 'x', '1', '2', '3', 'q', 'w', 'e', 'a', 's', 'd', 'z', 'c', '4', 'r', 'f', 'v' };
+
+static sf::Clock terminalClock;
+
+#ifdef _WIN32
+static DWORD savedInputMode;
+static DWORD savedOutputMode;
+#else
+static struct termios savedTerminal;
+#endif
+
+// Returns the index of the last byte of the escape sequence a key press sent, which starts with the ESC at buffer[start]
+static int skipEscapeSequence(const char * buffer, int length, int start) {
+	int i = start + 1;
+	if(buffer[i] == '[') {
+		// CSI, arrows, Home, F5 and up: parameter bytes then a final byte from @ to ~
+		i ++;
+		while(i < length && (buffer[i] < 0x40 || buffer[i] > 0x7E)) {
+			i ++;
+		}
+		return i < length ? i : length - 1;
+	}
+	if(buffer[i] == 'O' && i + 1 < length) {
+		// SS3, F1 to F4 and arrows in application mode
+		return i + 1;
+	}
+	// alt held down with a key
+	return i;
+}
+
+// Appends the escape sequence that moves the cursor to row and column, both counting from 1
+static void appendMove(std::string & out, unsigned int row, unsigned int column) {
+	char digits[24];
+	unsigned int length = 0;
+	// written backwards, column then row
+	do {
+		digits[length ++] = (char) ('0' + column % 10);
+		column /= 10;
+	} while(column > 0);
+	digits[length ++] = ';';
+	do {
+		digits[length ++] = (char) ('0' + row % 10);
+		row /= 10;
+	} while(row > 0);
+
+	out += "\x1B[";
+	while(length > 0) {
+		out += digits[-- length];
+	}
+	out += 'H';
+}
+
+TerminalDisplay::TerminalDisplay() {
+	for(unsigned int y = 0; y < GFX_HEIGHT / 2; y ++) {
+		for(unsigned int x = 0; x < GFX_WIDTH; x ++) {
+			cells[y][x] = 0xFF; // force the first frame to be drawn in full
+		}
+	}
+	for(unsigned int i = 0; i < 16; i ++) {
+		keyTime[i] = -1.f;
+	}
+	quit = false;
+	bytesWritten = 0;
+	framesWritten = 0;
+	frame.reserve(GFX_WIDTH * (GFX_HEIGHT / 2) * 3 + 1024);
+
+#ifdef _WIN32
+	HANDLE input = GetStdHandle(STD_INPUT_HANDLE);
+	HANDLE output = GetStdHandle(STD_OUTPUT_HANDLE);
+	GetConsoleMode(input, &savedInputMode);
+	GetConsoleMode(output, &savedOutputMode);
+	SetConsoleMode(input, savedInputMode & ~(ENABLE_LINE_INPUT | ENABLE_ECHO_INPUT));
+	SetConsoleMode(output, savedOutputMode | 0x0004); // ENABLE_VIRTUAL_TERMINAL_PROCESSING
+	SetConsoleOutputCP(CP_UTF8);
+#else
+	// no line buffering or echo, and reads return straight away. ctrl+c still works
+	tcgetattr(STDIN_FILENO, &savedTerminal);
+	struct termios raw = savedTerminal;
+	raw.c_lflag &= ~(ICANON | ECHO);
+	raw.c_cc[VMIN] = 0;
+	raw.c_cc[VTIME] = 0;
+	tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+#endif
+
+	write("\x1B[?25l\x1B[2J"); // hide the cursor and clear the screen
+}
+
+TerminalDisplay::~TerminalDisplay() {
+	// put the cursor back under the picture
+	std::string restore;
+	appendMove(restore, GFX_HEIGHT / 2 + 1, 1);
+	restore += "\x1B[?25h";
+	write(restore);
+
+#ifdef _WIN32
+	SetConsoleMode(GetStdHandle(STD_INPUT_HANDLE), savedInputMode);
+	SetConsoleMode(GetStdHandle(STD_OUTPUT_HANDLE), savedOutputMode);
+#else
+	tcsetattr(STDIN_FILENO, TCSANOW, &savedTerminal);
+#endif
+}
+
+void TerminalDisplay::draw(const unsigned long long * rows) {
+	frame.clear();
+	int cursorX = -1; // where the terminal cursor is after the last thing we wrote, -1 if unknown
+	int cursorY = -1;
+
+	for(unsigned int y = 0; y < GFX_HEIGHT / 2; y ++) {
+		unsigned long long top = rows[y * 2];
+		unsigned long long bottom = rows[y * 2 + 1];
+		for(unsigned int x = 0; x < GFX_WIDTH; x ++) {
+			unsigned char cell = (unsigned char) (((top >> (63 - x)) & 0x1) | (((bottom >> (63 - x)) & 0x1) << 1));
+			if(cell == cells[y][x]) {
+				continue;
+			}
+			cells[y][x] = cell;
+
+			// only move the cursor if it isn't already here from the last character,
+			// a short gap is cheaper to fill in with what is already there than to jump over
+			if(cursorY == (int) y && cursorX < (int) x && (int) x - cursorX <= 2) {
+				for(unsigned int gap = cursorX; gap < x; gap ++) {
+					frame += halfBlocks[cells[y][gap]];
+				}
+			}
+			else if(cursorY != (int) y || cursorX != (int) x) {
+				appendMove(frame, y + 1, x + 1);
+			}
+			frame += halfBlocks[cell];
+			cursorX = x + 1;
+			cursorY = y;
+		}
+	}
+
+	if(!frame.empty()) {
+		write(frame);
+		framesWritten ++;
+	}
+}
+
+unsigned short TerminalDisplay::readKeys() {
+	float now = terminalClock.getElapsedTime().asSeconds();
+	char buffer[64];
+	int length;
+
+#ifdef _WIN32
+	length = 0;
+	while(length < (int) sizeof(buffer) && _kbhit()) {
+		buffer[length ++] = (char) _getch();
+	}
+#else
+	length = (int) read(STDIN_FILENO, buffer, sizeof(buffer));
+#endif
+
+	for(int i = 0; i < length; i ++) {
+		char c = buffer[i];
+#ifdef _WIN32
+		if(c == 0 || c == (char) 0xE0) {
+			// arrow and function keys come as a prefix and a scan code, and scan codes like Delete's 'S' look like keypad keys
+			i ++;
+			continue;
+		}
+#endif
+		if(c == 0x1B) {
+			// only escape on its own quits, arrow keys and the like start with it too but arrive in the same read as the rest
+			if(i + 1 == length) {
+				quit = true;
+			}
+			else {
+				i = skipEscapeSequence(buffer, length, i);
+			}
+			continue;
+		}
+		if(c >= 'A' && c <= 'Z') {
+			c = c - 'A' + 'a';
+		}
+		for(unsigned int k = 0; k < 16; k ++) {
+			if(keypadKeys[k] == c) {
+				keyTime[k] = now;
+			}
+		}
+	}
+
+	unsigned short keys = 0;
+	for(unsigned int k = 0; k < 16; k ++) {
+		if(keyTime[k] >= 0.f && now - keyTime[k] < TERMINAL_KEY_HOLD) {
+			keys |= 1 << k;
+		}
+	}
+	return keys;
+}
+
+bool TerminalDisplay::quitRequested() {
+	return quit;
+}
+
+unsigned long long TerminalDisplay::getBytesWritten() {
+	return bytesWritten;
+}
+
+unsigned long long TerminalDisplay::getFramesWritten() {
+	return framesWritten;
+}
+
+void TerminalDisplay::write(const std::string & data) {
+	bytesWritten += data.size();
+#ifdef _WIN32
+	DWORD written;
+	WriteConsoleA(GetStdHandle(STD_OUTPUT_HANDLE), data.c_str(), (DWORD) data.size(), &written, NULL);
+#else
+	size_t done = 0;
+	while(done < data.size()) {
+		ssize_t written = ::write(STDOUT_FILENO, data.c_str() + done, data.size() - done);
+		if(written <= 0) {
+			break;
+		}
+		done += (size_t) written;
+	}
+#endif
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <string>
+#include "Chip8.h"
+
+// How long a key counts as held after the terminal last sent it, terminals only report presses and key repeats
+#define TERMINAL_KEY_HOLD 0.15f
+
+/*
+Shows the display in a terminal using Unicode half blocks, two rows of pixels to a line of text.
+Only the characters that changed since the last frame are written, with a cursor move in front of each
+run of changes, and the whole frame goes out in a single write so it stays smooth over SSH.
+The keypad is read from the terminal in raw mode using the same keys as the window.
+*/
+class TerminalDisplay {
+
+public:
+	// Switches the terminal into raw mode and clears it
+	TerminalDisplay();
+	// Puts the terminal back how it was
+	~TerminalDisplay();
+
+	// Writes the parts of the display that changed since the last call
+	void draw(const unsigned long long * rows);
+	// Reads any waiting key presses and returns the keypad as a mask with bit n set when key n is held down
+	unsigned short readKeys();
+	// Returns true once escape has been pressed
+	bool quitRequested();
+
+	unsigned long long getBytesWritten();
+	unsigned long long getFramesWritten();
+
+private:
+
+	TerminalDisplay(const TerminalDisplay & other);
+	TerminalDisplay & operator=(const TerminalDisplay & other);
+
+	void write(const std::string & data);
+
+	// What each character on screen currently shows, bit 0 is the top pixel and bit 1 the bottom, 0xFF when unknown
+	unsigned char cells[GFX_HEIGHT / 2][GFX_WIDTH];
+	std::string frame; // reused between frames so drawing doesn't allocate
+	float keyTime[16]; // when each key was last reported, in seconds since the display was created
+	bool quit;
+	unsigned long long bytesWritten;
+	unsigned long long framesWritten;
+
+};
@@ -0,0 +1,473 @@
+#include <chrono>
+#include <cstring>
+#include "Trace.h"
+
+#define TRACE_VERSION 2
+
+// Which parts of a record didn't match the prediction and are stored, four bits a record and two records to a byte
+#define TRACE_PC 0x1
+#define TRACE_OPCODE 0x2
+#define TRACE_I 0x4
+#define TRACE_REGISTERS 0x8
+
+/*
+What the encoder and decoder both expect the next record to be, starting from nothing at the start of each block.
+Programs spend most of their time in loops so the pc that followed a pc last time and the opcode last seen
+at a pc are nearly always right, and I only changes on its own with ANNN which gives the new value away.
+*/
+struct TracePredictor {
+	unsigned short lastPc;
+	unsigned short lastI;
+	unsigned short next[4096]; // the pc that came after each pc last time, 0 if it hasn't run yet
+	unsigned short opcodes[4096]; // the opcode last seen at each pc
+
+	TracePredictor() {
+		lastPc = 0x200 - 2; // so the first guess is the start of the program
+		lastI = 0;
+		memset(next, 0, sizeof(next));
+		memset(opcodes, 0, sizeof(opcodes));
+	}
+
+	unsigned short pc() {
+		unsigned short guess = next[lastPc & 0xFFF];
+		return guess != 0 ? guess : lastPc + 2;
+	}
+
+	unsigned short opcode(unsigned short pc) {
+		return opcodes[pc & 0xFFF];
+	}
+
+	unsigned short I(unsigned short opcode) {
+		return (opcode & 0xF000) == 0xA000 ? opcode & 0x0FFF : lastI;
+	}
+
+	void update(const TraceRecord & record) {
+		next[lastPc & 0xFFF] = record.pc;
+		opcodes[record.pc & 0xFFF] = record.opcode;
+		lastPc = record.pc;
+		lastI = record.I;
+	}
+};
+
+// Appends what predictor got wrong about record to out and returns its flags
+static unsigned char encodeRecord(const TraceRecord & record, TracePredictor & predictor, std::vector<unsigned char> & out) {
+	unsigned char flags = 0;
+	if(record.pc != predictor.pc()) {
+		flags |= TRACE_PC;
+		out.push_back((unsigned char) record.pc);
+		out.push_back((unsigned char) (record.pc >> 8));
+	}
+	if(record.opcode != predictor.opcode(record.pc)) {
+		flags |= TRACE_OPCODE;
+		out.push_back((unsigned char) record.opcode);
+		out.push_back((unsigned char) (record.opcode >> 8));
+	}
+	if(record.I != predictor.I(record.opcode)) {
+		flags |= TRACE_I;
+		out.push_back((unsigned char) record.I);
+		out.push_back((unsigned char) (record.I >> 8));
+	}
+	if(record.changed != 0) {
+		// which registers changed, then the new value of each of them in order
+		flags |= TRACE_REGISTERS;
+		out.push_back((unsigned char) record.changed);
+		out.push_back((unsigned char) (record.changed >> 8));
+		for(unsigned int i = 0; i < 16; i ++) {
+			if(record.changed & (1 << i)) {
+				out.push_back(record.values[i]);
+			}
+		}
+	}
+	predictor.update(record);
+	return flags;
+}
+
+// The opposite of encodeRecord(), returns false if the data runs out
+static bool decodeRecord(unsigned char flags, const std::vector<unsigned char> & in, size_t & at, TracePredictor & predictor, TraceRecord & record) {
+	// bytes each combination of flags needs at least, changed registers add one byte each to this
+	static const unsigned int sizes[16] = { 0, 2, 2, 4, 2, 4, 4, 6, 2, 4, 4, 6, 4, 6, 6, 8 };
+	if(at + sizes[flags] > in.size()) {
+		return false;
+	}
+	record.pc = predictor.pc();
+	if(flags & TRACE_PC) {
+		record.pc = (unsigned short) (in[at] | (in[at + 1] << 8));
+		at += 2;
+	}
+	record.opcode = predictor.opcode(record.pc);
+	if(flags & TRACE_OPCODE) {
+		record.opcode = (unsigned short) (in[at] | (in[at + 1] << 8));
+		at += 2;
+	}
+	record.I = predictor.I(record.opcode);
+	if(flags & TRACE_I) {
+		record.I = (unsigned short) (in[at] | (in[at + 1] << 8));
+		at += 2;
+	}
+	record.changed = 0;
+	memset(record.values, 0, sizeof(record.values));
+	if(flags & TRACE_REGISTERS) {
+		record.changed = (unsigned short) (in[at] | (in[at + 1] << 8));
+		at += 2;
+		for(unsigned int i = 0; i < 16; i ++) {
+			if(record.changed & (1 << i)) {
+				if(at >= in.size()) {
+					return false;
+				}
+				record.values[i] = in[at ++];
+			}
+		}
+	}
+	predictor.update(record);
+	return true;
+}
+
+
+// TraceWriter
+
+TraceWriter::TraceWriter(std::string fileName) {
+	head = 0;
+	cachedTail = 0;
+	tail = 0;
+	stopping = false;
+	bytesWritten = 0;
+
+	output.open(fileName, std::ios::binary);
+	open = output.is_open();
+	if(!open) {
+		std::cout << "Error: can't write a trace to " << fileName << std::endl;
+		return;
+	}
+
+	write((const unsigned char *) "C8TR", 4);
+	write32(TRACE_VERSION);
+	write32(TRACE_BLOCK);
+
+	ring.resize(TRACE_RING);
+	block.reserve(TRACE_BLOCK);
+	worker = std::thread(&TraceWriter::run, this);
+}
+
+TraceWriter::~TraceWriter() {
+	stop();
+}
+
+bool TraceWriter::isOpen() {
+	return open;
+}
+
+void TraceWriter::append(const TraceRecord & record) {
+	if(!open) {
+		return;
+	}
+	unsigned long long at = head.load(std::memory_order_relaxed);
+	if(at - cachedTail >= TRACE_RING) {
+		// looks full, see how far the writer has got and wait for it if it really is
+		cachedTail = tail.load(std::memory_order_acquire);
+		while(at - cachedTail >= TRACE_RING) {
+			std::this_thread::yield();
+			cachedTail = tail.load(std::memory_order_acquire);
+		}
+	}
+	ring[at & (TRACE_RING - 1)] = record;
+	head.store(at + 1, std::memory_order_release);
+}
+
+void TraceWriter::stop() {
+	if(worker.joinable()) {
+		stopping.store(true, std::memory_order_release);
+		worker.join();
+	}
+	if(output.is_open()) {
+		output.close();
+	}
+}
+
+unsigned long long TraceWriter::getRecords() {
+	return head.load(std::memory_order_relaxed);
+}
+
+unsigned long long TraceWriter::getBytesWritten() {
+	return bytesWritten;
+}
+
+void TraceWriter::run() {
+	unsigned long long at = tail.load(std::memory_order_relaxed);
+	while(true) {
+		// look at stopping before head, so nothing appended before stop() can be missed
+		bool finishing = stopping.load(std::memory_order_acquire);
+		unsigned long long end = head.load(std::memory_order_acquire);
+		if(at == end) {
+			if(finishing) {
+				break;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+
+		while(at < end) {
+			block.push_back(ring[at & (TRACE_RING - 1)]);
+			at ++;
+			if(block.size() == TRACE_BLOCK) {
+				// hand the space back before the slow part
+				tail.store(at, std::memory_order_release);
+				writeBlock();
+			}
+		}
+		tail.store(at, std::memory_order_release);
+	}
+
+	if(!block.empty()) {
+		writeBlock();
+	}
+	writeIndex();
+}
+
+void TraceWriter::writeBlock() {
+	TracePredictor predictor;
+	encoded.clear();
+	for(size_t i = 0; i < block.size(); i += 2) {
+		size_t flagsAt = encoded.size();
+		encoded.push_back(0);
+		unsigned char flags = encodeRecord(block[i], predictor, encoded);
+		if(i + 1 < block.size()) {
+			flags |= encodeRecord(block[i + 1], predictor, encoded) << 4;
+		}
+		encoded[flagsAt] = flags;
+	}
+
+	offsets.push_back(bytesWritten);
+	counts.push_back((unsigned int) block.size());
+	write32((unsigned int) block.size());
+	write32((unsigned int) encoded.size());
+	if(!encoded.empty()) {
+		write(&encoded[0], encoded.size());
+	}
+	block.clear();
+}
+
+void TraceWriter::writeIndex() {
+	unsigned long long indexAt = bytesWritten;
+	unsigned long long total = 0;
+	for(size_t i = 0; i < offsets.size(); i ++) {
+		write64(offsets[i]);
+		write32(counts[i]);
+		total += counts[i];
+	}
+	write((const unsigned char *) "C8TI", 4);
+	write64(indexAt);
+	write32((unsigned int) offsets.size());
+	write64(total);
+	output.flush();
+}
+
+void TraceWriter::write(const unsigned char * data, size_t size) {
+	output.write((const char *) data, size);
+	bytesWritten += size;
+}
+
+void TraceWriter::write32(unsigned int value) {
+	unsigned char bytes[4];
+	for(unsigned int i = 0; i < 4; i ++) {
+		bytes[i] = (unsigned char) (value >> (i * 8));
+	}
+	write(bytes, 4);
+}
+
+void TraceWriter::write64(unsigned long long value) {
+	unsigned char bytes[8];
+	for(unsigned int i = 0; i < 8; i ++) {
+		bytes[i] = (unsigned char) (value >> (i * 8));
+	}
+	write(bytes, 8);
+}
+
+
+// TraceReader
+
+// The footer is "C8TI", u64 index offset, u32 blocks and u64 records
+#define TRACE_FOOTER_SIZE 24
+#define TRACE_HEADER_SIZE 12
+
+TraceReader::TraceReader(std::string fileName) {
+	open = false;
+	fileSize = 0;
+	blockSize = 0;
+	records = 0;
+	decodedBlock = -1;
+
+	input.open(fileName, std::ios::binary);
+	if(!input.is_open()) {
+		std::cout << "Error: can't open trace " << fileName << std::endl;
+		return;
+	}
+	open = readIndex();
+	if(!open) {
+		std::cout << "Error: " << fileName << " isn't a trace" << std::endl;
+	}
+}
+
+bool TraceReader::isOpen() {
+	return open;
+}
+
+unsigned long long TraceReader::getRecords() {
+	return records;
+}
+
+unsigned int TraceReader::getBlockCount() {
+	return (unsigned int) offsets.size();
+}
+
+unsigned int TraceReader::getBlockSize() {
+	return blockSize;
+}
+
+bool TraceReader::read(unsigned long long cycle, TraceRecord & record) {
+	if(!open || cycle >= records) {
+		return false;
+	}
+	// every block but the last is full, so the block can be worked out without searching
+	unsigned int block = (unsigned int) (cycle / blockSize);
+	unsigned int offset = (unsigned int) (cycle % blockSize);
+	if((int) block != decodedBlock && !decodeBlock(block)) {
+		return false;
+	}
+	if(offset >= decoded.size()) {
+		return false;
+	}
+	record = decoded[offset];
+	return true;
+}
+
+bool TraceReader::readBlock(unsigned int block, std::vector<unsigned char> & bytes) {
+	if(!open || block >= offsets.size()) {
+		return false;
+	}
+	input.clear();
+	input.seekg(offsets[block]);
+	unsigned int count;
+	unsigned int size;
+	if(!read32(count) || !read32(size) || offsets[block] + 8 + size > fileSize) {
+		return false;
+	}
+	bytes.resize(size);
+	if(size > 0) {
+		input.read((char *) &bytes[0], size);
+	}
+	return !input.fail();
+}
+
+bool TraceReader::decodeBlock(unsigned int block) {
+	decodedBlock = -1;
+	if(!readBlock(block, bytes)) {
+		return false;
+	}
+
+	TracePredictor predictor;
+	decoded.resize(counts[block]);
+	size_t at = 0;
+	unsigned char pair = 0;
+	bool ok = true;
+	for(unsigned int i = 0; i < counts[block] && ok; i ++) {
+		unsigned char flags;
+		if(i % 2 == 0) {
+			if(at >= bytes.size()) {
+				ok = false;
+				break;
+			}
+			pair = bytes[at ++];
+			flags = pair & 0xF;
+		}
+		else {
+			flags = pair >> 4;
+		}
+		ok = decodeRecord(flags, bytes, at, predictor, decoded[i]);
+	}
+
+	if(ok) {
+		decodedBlock = (int) block;
+	}
+	return ok;
+}
+
+bool TraceReader::readIndex() {
+	input.seekg(0, std::ios::end);
+	fileSize = (unsigned long long) input.tellg();
+	input.seekg(0, std::ios::beg);
+
+	char magic[4];
+	unsigned int version;
+	input.read(magic, 4);
+	if(input.fail() || memcmp(magic, "C8TR", 4) != 0 || !read32(version) || version != TRACE_VERSION || !read32(blockSize) || blockSize == 0) {
+		return false;
+	}
+
+	// a finished file has an index at the end
+	if(fileSize >= TRACE_HEADER_SIZE + TRACE_FOOTER_SIZE) {
+		unsigned long long indexAt;
+		unsigned int blocks;
+		unsigned long long total;
+		input.seekg(fileSize - TRACE_FOOTER_SIZE);
+		input.read(magic, 4);
+		if(!input.fail() && memcmp(magic, "C8TI", 4) == 0 && read64(indexAt) && read32(blocks) && read64(total)
+			&& indexAt + (unsigned long long) blocks * 12 + TRACE_FOOTER_SIZE == fileSize) {
+			input.seekg(indexAt);
+			for(unsigned int i = 0; i < blocks; i ++) {
+				unsigned long long offset;
+				unsigned int count;
+				if(!read64(offset) || !read32(count)) {
+					return false;
+				}
+				offsets.push_back(offset);
+				counts.push_back(count);
+			}
+			records = total;
+			return true;
+		}
+	}
+
+	// otherwise walk the blocks, stopping at the first one that wasn't finished
+	input.clear();
+	unsigned long long at = TRACE_HEADER_SIZE;
+	while(at + 8 <= fileSize) {
+		input.seekg(at);
+		unsigned int count;
+		unsigned int size;
+		if(!read32(count) || !read32(size) || count == 0 || count > blockSize || at + 8 + size > fileSize) {
+			break;
+		}
+		offsets.push_back(at);
+		counts.push_back(count);
+		records += count;
+		at += 8 + size;
+	}
+	input.clear();
+	return true;
+}
+
+bool TraceReader::read32(unsigned int & value) {
+	unsigned char bytes[4];
+	input.read((char *) bytes, 4);
+	if(input.fail()) {
+		return false;
+	}
+	value = 0;
+	for(unsigned int i = 0; i < 4; i ++) {
+		value |= (unsigned int) bytes[i] << (i * 8);
+	}
+	return true;
+}
+
+bool TraceReader::read64(unsigned long long & value) {
+	unsigned char bytes[8];
+	input.read((char *) bytes, 8);
+	if(input.fail()) {
+		return false;
+	}
+	value = 0;
+	for(unsigned int i = 0; i < 8; i ++) {
+		value |= (unsigned long long) bytes[i] << (i * 8);
+	}
+	return true;
+}
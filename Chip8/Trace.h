@@ -0,0 +1,142 @@
+#pragma once
+#include <string>
+#include <fstream>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include "Chip8.h"
+
+// What one instruction did, as appended by Chip8::traceCycle()
+struct TraceRecord {
+	unsigned short pc; // where the instruction was
+	unsigned short opcode;
+	unsigned short I; // I after the instruction ran
+	unsigned short changed; // bit n is set if the instruction changed Vn, so a changed VF is never hidden behind Vx
+	unsigned char values[16]; // what each changed register became, 0 for the rest
+};
+
+// Records the ring between the emulator and the writer thread holds, a power of 2
+#define TRACE_RING 65536
+// Records in each compressed block of the file, every block can be decoded on its own
+#define TRACE_BLOCK 16384
+
+/*
+Writes an instruction trace to a file without slowing the emulator down much.
+append() copies the record into a single producer single consumer ring and never takes a lock,
+a background thread drains the ring, compresses it a block at a time and writes it out.
+If the writer falls behind append() waits for room rather than losing records, a trace with gaps would be no use for diffing.
+
+File format, all numbers little endian:
+	"C8TR", u32 version, u32 TRACE_BLOCK
+	blocks: u32 records, u32 bytes, then the compressed records
+	index: u64 file offset and u32 records of each block
+	footer: "C8TI", u64 offset of the index, u32 blocks, u64 records
+Records are predicted from the ones before them in the same block and only what was mispredicted is stored,
+so a block can be found through the index and decoded without reading anything before it.
+*/
+class TraceWriter {
+
+public:
+	// Creates fileName and starts the writer thread
+	TraceWriter(std::string fileName);
+	// Writes anything still in the ring and closes the file
+	~TraceWriter();
+
+	// Returns false if the file couldn't be created
+	bool isOpen();
+
+	// Queues a record, only ever call this from one thread
+	void append(const TraceRecord & record);
+
+	// Waits for the writer thread to write everything appended then finishes the file, called by the destructor
+	void stop();
+
+	// Returns how many records have been appended
+	unsigned long long getRecords();
+	// Returns the size of the file, only valid once stop() has returned
+	unsigned long long getBytesWritten();
+
+private:
+
+	TraceWriter(const TraceWriter & other);
+	TraceWriter & operator=(const TraceWriter & other);
+
+	// Body of the writer thread
+	void run();
+	// Compresses block and writes it to the file
+	void writeBlock();
+	// Writes the index and footer once every block is out
+	void writeIndex();
+	void write(const unsigned char * data, size_t size);
+	void write32(unsigned int value);
+	void write64(unsigned long long value);
+
+	std::ofstream output;
+	bool open;
+	std::vector<TraceRecord> ring;
+
+	// Emulator side, head is only written by append()
+	std::atomic<unsigned long long> head;
+	unsigned long long cachedTail; // the last tail append() saw, so it only has to look again when the ring seems full
+	char padding[CACHE_LINE]; // keeps head and tail on different cache lines
+
+	// Writer side, tail is only written by the writer thread
+	std::atomic<unsigned long long> tail;
+	std::atomic<bool> stopping;
+	std::vector<TraceRecord> block;
+	std::vector<unsigned char> encoded;
+	std::vector<unsigned long long> offsets; // where each block starts in the file
+	std::vector<unsigned int> counts; // how many records each block holds
+	unsigned long long bytesWritten;
+
+	std::thread worker;
+
+};
+
+/*
+Reads a file written by TraceWriter. If the file was never finished, for example because the emulator crashed,
+the index is rebuilt by walking the blocks so everything up to the last complete block can still be read.
+*/
+class TraceReader {
+
+public:
+	TraceReader(std::string fileName);
+
+	// Returns false if the file couldn't be opened or isn't a trace
+	bool isOpen();
+
+	unsigned long long getRecords();
+	unsigned int getBlockCount();
+	// Records in every block but the last, so block n starts at cycle n * getBlockSize()
+	unsigned int getBlockSize();
+
+	// Reads the record for cycle, returns false past the end. Only the block holding it is decoded
+	bool read(unsigned long long cycle, TraceRecord & record);
+	// Reads the compressed bytes of block, two blocks with the same bytes hold the same records
+	bool readBlock(unsigned int block, std::vector<unsigned char> & bytes);
+
+private:
+
+	TraceReader(const TraceReader & other);
+	TraceReader & operator=(const TraceReader & other);
+
+	// Builds the index from the footer, or by walking the blocks if there isn't one
+	bool readIndex();
+	bool decodeBlock(unsigned int block);
+	bool read32(unsigned int & value);
+	bool read64(unsigned long long & value);
+
+	std::ifstream input;
+	bool open;
+	unsigned long long fileSize;
+	unsigned int blockSize; // records in every block but the last
+	std::vector<unsigned long long> offsets;
+	std::vector<unsigned int> counts;
+	unsigned long long records;
+
+	// The last block decoded
+	int decodedBlock;
+	std::vector<TraceRecord> decoded;
+	std::vector<unsigned char> bytes;
+
+};
@@ -0,0 +1,264 @@
+#include <cstring>
+#include "Upscaler.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define UPSCALER_SSE2
+#endif
+
+// How much of a phosphor's brightness is left each frame after it is switched off, out of 256
+#define PHOSPHOR_DECAY 140
+
+static const unsigned long long leftMost = 1ULL << 63;
+
+// The neighbour to the left of every pixel in a row, the edge pixel is its own neighbour
+static inline unsigned long long leftOf(unsigned long long row) {
+	return (row >> 1) | (row & leftMost);
+}
+
+// The neighbour to the right of every pixel in a row
+static inline unsigned long long rightOf(unsigned long long row) {
+	return (row << 1) | (row & 0x1);
+}
+
+// Writes the 64 pixels of bits as 0 or 255, stride apart
+static inline void putBits(unsigned char * out, unsigned long long bits, unsigned int stride) {
+	for(unsigned int x = 0; x < GFX_WIDTH; x ++) {
+		out[x * stride] = (unsigned char) (0 - (unsigned char) ((bits >> (63 - x)) & 0x1));
+	}
+}
+
+// Fills count pixels with color, 4 at a time. May write up to 3 pixels past the end
+static inline void fill(unsigned int * out, unsigned int color, unsigned int count) {
+#ifdef UPSCALER_SSE2
+	__m128i colors = _mm_set1_epi32((int) color);
+	for(unsigned int i = 0; i < count; i += 4) {
+		_mm_storeu_si128((__m128i *) (out + i), colors);
+	}
+#else
+	for(unsigned int i = 0; i < count; i ++) {
+		out[i] = color;
+	}
+#endif
+}
+
+Upscaler::Upscaler(unsigned int scale, UpscaleFilter filter) {
+	this->filter = filter;
+	if(scale < 1) {
+		scale = 1;
+	}
+
+	// the smoothing filters grow the image by a fixed amount first, round the scale down to fit
+	unsigned int smoothing = filter == FILTER_SCALE2X ? 2 : filter == FILTER_SCALE3X ? 3 : 1;
+	if(scale < smoothing) {
+		scale = smoothing;
+	}
+	this->scale = scale - (scale % smoothing);
+	width = GFX_WIDTH * smoothing;
+	height = GFX_HEIGHT * smoothing;
+
+	levels.resize(width * height, 0);
+	row.resize(GFX_WIDTH * this->scale + 4);
+	output.resize(GFX_WIDTH * GFX_HEIGHT * this->scale * this->scale);
+	fading = false;
+
+	setPalette(MAKE_COLOR(0, 0, 0), MAKE_COLOR(255, 255, 255));
+}
+
+void Upscaler::setPalette(unsigned int off, unsigned int on) {
+	this->off = off;
+	this->on = on;
+	buildLookup();
+}
+
+bool Upscaler::setPalette(std::string name) {
+	if(name == "white") {
+		setPalette(MAKE_COLOR(0, 0, 0), MAKE_COLOR(255, 255, 255));
+	}
+	else if(name == "green") {
+		setPalette(MAKE_COLOR(8, 24, 8), MAKE_COLOR(51, 255, 102));
+	}
+	else if(name == "amber") {
+		setPalette(MAKE_COLOR(24, 14, 0), MAKE_COLOR(255, 176, 0));
+	}
+	else if(name == "lcd") {
+		setPalette(MAKE_COLOR(155, 188, 15), MAKE_COLOR(15, 56, 15));
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+void Upscaler::buildLookup() {
+	for(unsigned int level = 0; level < 256; level ++) {
+		unsigned int color = 0xFF000000u;
+		unsigned int dim = 0xFF000000u;
+		for(unsigned int shift = 0; shift < 24; shift += 8) {
+			unsigned int from = (off >> shift) & 0xFF;
+			unsigned int to = (on >> shift) & 0xFF;
+			unsigned int channel = (from * (255 - level) + to * level) / 255;
+			color |= channel << shift;
+			dim |= (channel / 2) << shift;
+		}
+		lookup[level] = color;
+		dimLookup[level] = dim;
+	}
+}
+
+unsigned int Upscaler::getScale() {
+	return scale;
+}
+
+unsigned int Upscaler::getOutputWidth() {
+	return GFX_WIDTH * scale;
+}
+
+unsigned int Upscaler::getOutputHeight() {
+	return GFX_HEIGHT * scale;
+}
+
+bool Upscaler::isAnimated() {
+	return fading;
+}
+
+const unsigned char * Upscaler::render(const unsigned long long * rows) {
+	switch(filter) {
+	case FILTER_NEAREST:
+		for(unsigned int y = 0; y < GFX_HEIGHT; y ++) {
+			putBits(&levels[y * width], rows[y], 1);
+		}
+		expand(scale, false);
+		break;
+
+	case FILTER_SCALE2X:
+		scale2x(rows);
+		expand(scale / 2, false);
+		break;
+
+	case FILTER_SCALE3X:
+		scale3x(rows);
+		expand(scale / 3, false);
+		break;
+
+	case FILTER_SCANLINE:
+		// lit pixels jump to full brightness and fade out slowly, which also hides most Chip 8 flicker
+		fading = false;
+		for(unsigned int y = 0; y < GFX_HEIGHT; y ++) {
+			unsigned char * level = &levels[y * width];
+			for(unsigned int x = 0; x < GFX_WIDTH; x ++) {
+				if((rows[y] >> (63 - x)) & 0x1) {
+					level[x] = 255;
+				}
+				else if(level[x] != 0) {
+					level[x] = (unsigned char) ((level[x] * PHOSPHOR_DECAY) >> 8);
+					fading = true;
+				}
+			}
+		}
+		expand(scale, true);
+		break;
+	}
+	return (const unsigned char *) &output[0];
+}
+
+/*
+Scale2x on a 1 bit image. With E the pixel, B above, D left, F right and H below:
+	E0 = D == B && B != F && D != H ? D : E    E1 = B == F && B != D && F != H ? F : E
+	E2 = D == H && D != B && H != F ? D : E    E3 = H == F && D != H && B != F ? F : E
+Every comparison is an XOR, so a whole row of 64 pixels is done at once.
+*/
+void Upscaler::scale2x(const unsigned long long * rows) {
+	for(unsigned int y = 0; y < GFX_HEIGHT; y ++) {
+		unsigned long long E = rows[y];
+		unsigned long long B = y > 0 ? rows[y - 1] : E;
+		unsigned long long H = y < GFX_HEIGHT - 1 ? rows[y + 1] : E;
+		unsigned long long D = leftOf(E);
+		unsigned long long F = rightOf(E);
+
+		unsigned long long rule0 = ~(D ^ B) & (B ^ F) & (D ^ H);
+		unsigned long long rule1 = ~(B ^ F) & (B ^ D) & (F ^ H);
+		unsigned long long rule2 = ~(D ^ H) & (D ^ B) & (H ^ F);
+		unsigned long long rule3 = ~(H ^ F) & (D ^ H) & (B ^ F);
+
+		unsigned char * top = &levels[(y * 2) * width];
+		unsigned char * bottom = top + width;
+		putBits(top, (rule0 & D) | (~rule0 & E), 2);
+		putBits(top + 1, (rule1 & F) | (~rule1 & E), 2);
+		putBits(bottom, (rule2 & D) | (~rule2 & E), 2);
+		putBits(bottom + 1, (rule3 & F) | (~rule3 & E), 2);
+	}
+}
+
+/*
+Scale3x on a 1 bit image, the same idea as scale2x() with the corners A, C, G and I as well:
+	A B C    E0 E1 E2
+	D E F => E3 E4 E5
+	G H I    E6 E7 E8
+*/
+void Upscaler::scale3x(const unsigned long long * rows) {
+	for(unsigned int y = 0; y < GFX_HEIGHT; y ++) {
+		unsigned long long E = rows[y];
+		unsigned long long B = y > 0 ? rows[y - 1] : E;
+		unsigned long long H = y < GFX_HEIGHT - 1 ? rows[y + 1] : E;
+		unsigned long long A = leftOf(B);
+		unsigned long long C = rightOf(B);
+		unsigned long long D = leftOf(E);
+		unsigned long long F = rightOf(E);
+		unsigned long long G = leftOf(H);
+		unsigned long long I = rightOf(H);
+
+		unsigned long long db = ~(D ^ B) & (D ^ H) & (B ^ F); // D == B && D != H && B != F
+		unsigned long long bf = ~(B ^ F) & (B ^ D) & (F ^ H); // B == F && B != D && F != H
+		unsigned long long dh = ~(D ^ H) & (D ^ B) & (H ^ F); // D == H && D != B && H != F
+		unsigned long long hf = ~(H ^ F) & (D ^ H) & (B ^ F); // H == F && D != H && B != F
+
+		unsigned long long rule1 = (db & (E ^ C)) | (bf & (E ^ A));
+		unsigned long long rule3 = (db & (E ^ G)) | (dh & (E ^ A));
+		unsigned long long rule5 = (bf & (E ^ I)) | (hf & (E ^ C));
+		unsigned long long rule7 = (dh & (E ^ I)) | (hf & (E ^ G));
+
+		unsigned char * top = &levels[(y * 3) * width];
+		unsigned char * middle = top + width;
+		unsigned char * bottom = middle + width;
+		putBits(top, (db & D) | (~db & E), 3);
+		putBits(top + 1, (rule1 & B) | (~rule1 & E), 3);
+		putBits(top + 2, (bf & F) | (~bf & E), 3);
+		putBits(middle, (rule3 & D) | (~rule3 & E), 3);
+		putBits(middle + 1, E, 3);
+		putBits(middle + 2, (rule5 & F) | (~rule5 & E), 3);
+		putBits(bottom, (dh & D) | (~dh & E), 3);
+		putBits(bottom + 1, (rule7 & H) | (~rule7 & E), 3);
+		putBits(bottom + 2, (hf & F) | (~hf & E), 3);
+	}
+}
+
+void Upscaler::expand(unsigned int factor, bool scanlines) {
+	unsigned int outputWidth = width * factor;
+	// darken the bottom third of each line of pixels, at least one row once there is room for it
+	unsigned int gap = scanlines && factor >= 2 ? (factor / 3 > 0 ? factor / 3 : 1) : 0;
+
+	unsigned int * out = &output[0];
+	for(unsigned int y = 0; y < height; y ++) {
+		const unsigned char * level = &levels[y * width];
+
+		// build the row once and copy it down, every row of a pixel is the same
+		for(unsigned int x = 0; x < width; x ++) {
+			fill(&row[x * factor], lookup[level[x]], factor);
+		}
+		for(unsigned int i = 0; i < factor - gap; i ++) {
+			memcpy(out, &row[0], outputWidth * sizeof(unsigned int));
+			out += outputWidth;
+		}
+
+		if(gap > 0) {
+			for(unsigned int x = 0; x < width; x ++) {
+				fill(&row[x * factor], dimLookup[level[x]], factor);
+			}
+			for(unsigned int i = 0; i < gap; i ++) {
+				memcpy(out, &row[0], outputWidth * sizeof(unsigned int));
+				out += outputWidth;
+			}
+		}
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Chip8.h"
+
+enum UpscaleFilter {
+	FILTER_NEAREST,  // plain square pixels
+	FILTER_SCALE2X,  // Scale2x/EPX edge smoothing, then square pixels for the rest of the scale
+	FILTER_SCALE3X,  // Scale3x edge smoothing, then square pixels for the rest of the scale
+	FILTER_SCANLINE  // square pixels that fade out like phosphor with dark gaps between the lines
+};
+
+// Packs a colour the way sf::Texture expects to find it in memory, RGBA
+#define MAKE_COLOR(r, g, b) ((unsigned int) (r) | ((unsigned int) (g) << 8) | ((unsigned int) (b) << 16) | 0xFF000000u)
+
+/*
+Expands the packed display into an RGBA image at any whole number scale, ready to be uploaded as a single texture.
+Edge smoothing works on 64 pixel rows at a time with bit operations and the colour expansion writes
+4 pixels per SSE2 store, so even 4K output is a few milliseconds of one core.
+*/
+class Upscaler {
+
+public:
+	Upscaler(unsigned int scale, UpscaleFilter filter);
+
+	// Sets the colours used for pixels that are off and on
+	void setPalette(unsigned int off, unsigned int on);
+	// Picks a built in palette, white, green, amber or lcd. Returns false if name isn't one of them
+	bool setPalette(std::string name);
+
+	// The scale actually used, Scale2x and Scale3x need a multiple of 2 or 3
+	unsigned int getScale();
+	unsigned int getOutputWidth();
+	unsigned int getOutputHeight();
+
+	// Renders GFX_HEIGHT packed rows, returns getOutputWidth() * getOutputHeight() RGBA pixels
+	const unsigned char * render(const unsigned long long * rows);
+	// Returns true while the last render is still changing on its own, so it should be rendered again even if the display hasn't changed
+	bool isAnimated();
+
+private:
+
+	// Writes the smoothed image into levels at factor times the size of the display
+	void scale2x(const unsigned long long * rows);
+	void scale3x(const unsigned long long * rows);
+	// Turns levels into colours, each level becoming a factor * factor block
+	void expand(unsigned int factor, bool scanlines);
+	void buildLookup();
+
+	unsigned int scale;
+	UpscaleFilter filter;
+	unsigned int off;
+	unsigned int on;
+
+	unsigned int width; // size of levels
+	unsigned int height;
+	std::vector<unsigned char> levels; // brightness of each pixel after smoothing, 0 is off and 255 is on
+	unsigned int lookup[256]; // colour for each level
+	unsigned int dimLookup[256]; // the same but darker, for the gaps between scanlines
+	bool fading;
+
+	std::vector<unsigned int> row; // one expanded output row, with room for SSE stores to run over the end
+	std::vector<unsigned int> output;
+
+};
@@ -1,17 +1,158 @@
 #include <SFML/Graphics.hpp>
 #include <sstream>
+#include <iomanip>
+#include <vector>
+#include <cstdlib>
+#include <csignal>
+#include <cstring>
+#include <cctype>
 #include "Chip8.h"
+#include "Chip8Arena.h"
+#include "FrameCapture.h"
+#include "FrameStream.h"
+#include "Debugger.h"
+#include "Upscaler.h"
+#include "TerminalDisplay.h"
+#include "Telemetry.h"
+#include "Overlay.h"
+#include "Trace.h"
+#include "FusionCheck.h"
 
-void drawScreen(unsigned int width, unsigned int height, const unsigned char * gfx, sf::RenderWindow * window);
+void drawScreen(Upscaler & upscaler, sf::Texture & texture, const unsigned long long * rows, sf::RenderWindow * window);
+void drawOverlay(Overlay & overlay, sf::Texture & texture, float scale, sf::RenderWindow * window);
 void debugOutput(const unsigned char * gfx, unsigned int width, unsigned int height);
 void updateKeystate(Chip8  & chip);
+unsigned short keypadState();
+int runBenchmark(std::string gameName, unsigned int instances);
+int runServer(Chip8 & chip, unsigned short port, FrameCapture * capture, Telemetry & telemetry, TraceWriter * trace);
+int runClient(std::string address, Upscaler & upscaler, bool terminal);
+int runTerminal(Chip8 & chip, FrameCapture * capture, Telemetry & telemetry, TraceWriter * trace);
+int runTraceDiff(std::string first, std::string second);
+void closeTrace(TraceWriter * trace);
+bool addBreakpoint(Debugger & debugger, std::string spec);
+bool addWatchpoint(Debugger & debugger, std::string spec);
+
+// Cleared by ctrl+c so headless loops can shut down cleanly
+static volatile sig_atomic_t running = 1;
+void stopRunning(int signal) {
+	running = 0;
+}
 
 int main(int argc, char ** argv) {
 	bool stepMode = false;
 	bool step = false;
 	bool fastmode = false;
+	// Chip8 <rom> [--bench <instances>] [--record <file>] [--serve <port>] [--break <address>[:<reg><op><value>]] [--watch <start>[-<end>]]
+	//            [--display window|terminal] [--scale <n>] [--filter nearest|scale2x|scale3x|scanline] [--palette white|green|amber|lcd]
+	//            [--metrics <file>] [--overlay on|off] [--trace <file>] [--seed <n>]
+	// Chip8 --diff <trace> <trace>
+	// Chip8 --check <programs> [--seed <n>]
+	// Chip8 --connect <host:port> [--display window|terminal] [--scale <n>] [--filter <filter>] [--palette <palette>]
+	Debugger debugger;
+	unsigned int benchInstances = 0;
+	unsigned int checkPrograms = 0;
+	std::string recordFile;
+	unsigned short servePort = 0;
+	std::string connectAddress;
+	unsigned int scale = UPSCALE;
+	UpscaleFilter filter = FILTER_NEAREST;
+	std::string palette = "white";
+	bool terminal = false;
+	std::string metricsFile;
+	bool showOverlay = false;
+	std::string traceFile;
+	bool seeded = false;
+	unsigned int seed = 0;
+	if(argc >= 4 && std::string(argv[1]) == "--diff") {
+		return runTraceDiff(argv[2], argv[3]);
+	}
+	int firstOption = argc >= 2 && std::string(argv[1]).compare(0, 2, "--") == 0 ? 1 : 2;
+	for(int i = firstOption; i + 1 < argc; i += 2) {
+		std::string option = argv[i];
+		std::string value = argv[i + 1];
+		if(option == "--connect") {
+			connectAddress = value;
+		}
+		else if(option == "--scale") {
+			scale = (unsigned int) atoi(argv[i + 1]);
+		}
+		else if(option == "--filter") {
+			if(value == "nearest") {
+				filter = FILTER_NEAREST;
+			}
+			else if(value == "scale2x") {
+				filter = FILTER_SCALE2X;
+			}
+			else if(value == "scale3x") {
+				filter = FILTER_SCALE3X;
+			}
+			else if(value == "scanline") {
+				filter = FILTER_SCANLINE;
+			}
+			else {
+				std::cout << "Unknown filter " << value << std::endl;
+			}
+		}
+		else if(option == "--palette") {
+			palette = value;
+		}
+		else if(option == "--display") {
+			terminal = value == "terminal";
+		}
+		else if(option == "--metrics") {
+			metricsFile = value;
+		}
+		else if(option == "--overlay") {
+			showOverlay = value == "on";
+		}
+		else if(option == "--trace") {
+			traceFile = value;
+		}
+		else if(option == "--seed") {
+			seeded = true;
+			seed = (unsigned int) strtoul(argv[i + 1], nullptr, 10);
+		}
+		else if(option == "--check") {
+			checkPrograms = (unsigned int) atoi(argv[i + 1]);
+		}
+		else if(option == "--bench") {
+			benchInstances = (unsigned int) atoi(argv[i + 1]);
+		}
+		else if(option == "--record") {
+			recordFile = argv[i + 1];
+		}
+		else if(option == "--serve") {
+			servePort = (unsigned short) atoi(argv[i + 1]);
+		}
+		else if(option == "--break") {
+			addBreakpoint(debugger, argv[i + 1]);
+		}
+		else if(option == "--watch") {
+			addWatchpoint(debugger, argv[i + 1]);
+		}
+		else {
+			std::cout << "Unknown option " << option << std::endl;
+		}
+	}
+	if(checkPrograms > 0) {
+		unsigned int failures = checkFusion(checkPrograms, seeded ? seed : 1);
+		std::cout << failures << " of " << checkPrograms << " programs ran differently through run() than through cycle()" << std::endl;
+		return failures == 0 ? 0 : 1;
+	}
+	if(benchInstances > 0) {
+		return runBenchmark(argv[1], benchInstances);
+	}
+
+	Upscaler upscaler(scale, filter);
+	if(!upscaler.setPalette(palette)) {
+		std::cout << "Unknown palette " << palette << std::endl;
+	}
+	if(!connectAddress.empty()) {
+		return runClient(connectAddress, upscaler, terminal);
+	}
+
 	Chip8 chip8;
-	if(argc < 2) {
+	if(argc < 2 || firstOption == 1) {
 		std::cout << "No game argument given!" << std::endl;
 		// for testing load a file anyway
 		chip8.loadGame("roms/trip8.c8");
@@ -19,13 +160,51 @@ int main(int argc, char ** argv) {
 	else {
 		chip8.loadGame(argv[1]);
 	}
-	sf::RenderWindow * window = new sf::RenderWindow(sf::VideoMode(chip8.getWidth() * UPSCALE, chip8.getHeight() * UPSCALE), "Chip 8 Emulator");
+	if(seeded) {
+		chip8.setSeed(seed);
+	}
+	FrameCapture * capture = nullptr;
+	if(!recordFile.empty()) {
+		capture = new FrameCapture(recordFile);
+	}
+	Telemetry telemetry;
+	if(!metricsFile.empty()) {
+		telemetry.openMetrics(metricsFile);
+	}
+	TraceWriter * trace = nullptr;
+	if(!traceFile.empty()) {
+		trace = new TraceWriter(traceFile);
+		debugger.setTrace(trace);
+	}
+
+	if(servePort != 0) {
+		int result = runServer(chip8, servePort, capture, telemetry, trace);
+		delete capture;
+		closeTrace(trace);
+		return result;
+	}
+	if(terminal) {
+		int result = runTerminal(chip8, capture, telemetry, trace);
+		delete capture;
+		closeTrace(trace);
+		return result;
+	}
+
+	sf::RenderWindow * window = new sf::RenderWindow(sf::VideoMode(upscaler.getOutputWidth(), upscaler.getOutputHeight()), "Chip 8 Emulator");
 	window->setFramerateLimit(60);
+	sf::Texture texture;
+	texture.create(upscaler.getOutputWidth(), upscaler.getOutputHeight());
+	Overlay overlay;
+	sf::Texture overlayTexture;
+	bool overlayChanged = false;
+	float overlayScale = upscaler.getScale() / 5 > 1 ? (float) (upscaler.getScale() / 5) : 1.f;
 
-	static float refreshSpeed= 1.f/60.f;
+	static float refreshSpeed= 1.f/SPEED;
 	sf::Clock clock;
-	const unsigned char * gfx = nullptr;
+	const unsigned long long * gfx = nullptr;
     while(window->isOpen()) {
+		unsigned int cycles = 0;
+		bool drawn = false;
         sf::Event event;
         while (window->pollEvent(event)) {
             if(event.type == sf::Event::Closed)
@@ -43,19 +222,56 @@ int main(int argc, char ** argv) {
 				else if(event.key.code == sf::Keyboard::G) {
 					fastmode = !fastmode;
 				}
+				else if(event.key.code == sf::Keyboard::I) {
+					debugger.printRegisters(chip8);
+					debugger.printCallStack(chip8);
+				}
+				else if(event.key.code == sf::Keyboard::M) {
+					debugger.printMemory(chip8, chip8.getI(), 64);
+				}
+				else if(event.key.code == sf::Keyboard::T) {
+					showOverlay = !showOverlay;
+					overlayChanged = true;
+				}
 			}
         }
 
-		if( (!stepMode && clock.getElapsedTime().asSeconds() >= refreshSpeed) || (stepMode && step) || fastmode ) {
+		// fast mode only runs free outside step mode, so a breakpoint still stops the game with G held
+		if( (!stepMode && (fastmode || clock.getElapsedTime().asSeconds() >= refreshSpeed)) || (stepMode && step) ) {
+			telemetry.enterPhase(TELEMETRY_EMULATION);
 			updateKeystate(chip8);
-			chip8.cycle();
-			if(chip8.getNeedRedraw()) {
+			cycles = 1;
+			if(debugger.isActive()) {
+				if(!debugger.step(chip8)) {
+					// drop into step mode so the game can be inspected
+					stepMode = true;
+					std::cout << debugger.getStopReason() << std::endl;
+					debugger.printRegisters(chip8);
+					cycles = 0;
+				}
+			}
+			else if(trace != nullptr) {
+				chip8.traceCycle(*trace);
+			}
+			else {
+				chip8.cycle();
+			}
+			if(capture != nullptr) {
+				capture->submit(chip8.getPackedGraphics(), chip8.getHeight());
+			}
+			if(chip8.getNeedRedraw() || upscaler.isAnimated() || overlayChanged) {
+				telemetry.enterPhase(TELEMETRY_RENDER);
 				window->clear();
 				// draw
-				gfx = chip8.getGraphics();
-				drawScreen(chip8.getWidth(), chip8.getHeight(), gfx, window);
+				gfx = chip8.getPackedGraphics();
+				drawScreen(upscaler, texture, gfx, window);
+				if(showOverlay) {
+					drawOverlay(overlay, overlayTexture, overlayScale, window);
+				}
 				window->display();
+				drawn = chip8.getNeedRedraw();
 				chip8.setNeedRedraw(false);
+				overlayChanged = false;
 			}
 			clock.restart();
 			if(stepMode) {
@@ -64,30 +280,51 @@ int main(int argc, char ** argv) {
 		}
 
 		if(!stepMode && !fastmode) {
-			sf::sleep(sf::milliseconds(1000 / 60)); // sleep this thread for 1/60th of a second
+			telemetry.enterPhase(TELEMETRY_SLEEP);
+			sf::sleep(sf::milliseconds(1000 / SPEED)); // sleep this thread for 1/60th of a second
+		}
+
+		if(telemetry.endFrame(chip8, cycles, drawn) && showOverlay) {
+			overlay.setText(telemetry.getSummary());
+			overlayChanged = true;
 		}
     }
 	gfx = nullptr;
 	delete window;
 	window = nullptr;
 
-    return 0;
-}
-
-void drawScreen(unsigned int width, unsigned int height, const unsigned char * gfx, sf::RenderWindow * window) {
-	sf::RectangleShape rectangle(sf::Vector2f(UPSCALE, UPSCALE));
-	rectangle.setFillColor(sf::Color::White);
-	for(unsigned int y = 0; y < height; y ++) {
-		for(unsigned int x = 0; x < width; x ++) {
-			unsigned char state = gfx[x + (width*y)];
-			if(state > 0) {
-				rectangle.setPosition( (float) (x * UPSCALE), (float) (y * UPSCALE));
-				window->draw(rectangle);
-			}
+	if(capture != nullptr) {
+		capture->stop();
+		if(capture->getFramesDropped() > 0) {
+			std::cout << "Recording dropped " << capture->getFramesDropped() << " frames" << std::endl;
 		}
+		delete capture;
+		capture = nullptr;
 	}
+	closeTrace(trace);
+	trace = nullptr;
+
+    return 0;
+}
 
+void drawScreen(Upscaler & upscaler, sf::Texture & texture, const unsigned long long * rows, sf::RenderWindow * window) {
+	// the whole screen is built on the CPU and uploaded in one go
+	texture.update(upscaler.render(rows));
+	sf::Sprite sprite;
+	sprite.setTexture(texture);
+	window->draw(sprite);
+}
 
+void drawOverlay(Overlay & overlay, sf::Texture & texture, float scale, sf::RenderWindow * window) {
+	if(texture.getSize().x != overlay.getWidth() || texture.getSize().y != overlay.getHeight()) {
+		texture.create(overlay.getWidth(), overlay.getHeight());
+	}
+	texture.update(overlay.getPixels());
+	sf::Sprite sprite;
+	sprite.setTexture(texture);
+	sprite.setPosition(scale, scale);
+	sprite.setScale(scale, scale);
+	window->draw(sprite);
 }
 
 void debugOutput(const unsigned char * gfx, unsigned int width, unsigned int height) {
@@ -119,23 +356,404 @@ Keypad                   Keyboard
 */
 
 void updateKeystate(Chip8  & chip) {
-	chip.setKeyState(0x1, sf::Keyboard::isKeyPressed(sf::Keyboard::Key::Num1)); // 1
-	chip.setKeyState(0x2, sf::Keyboard::isKeyPressed(sf::Keyboard::Key::Num2)); // 2
-	chip.setKeyState(0x3, sf::Keyboard::isKeyPressed(sf::Keyboard::Key::Num3)); // 3
-	chip.setKeyState(0xC, sf::Keyboard::isKeyPressed(sf::Keyboard::Key::Num4)); // C
-
-	chip.setKeyState(0x4, sf::Keyboard::isKeyPressed(sf::Keyboard::Key::Q)); // 4
-	chip.setKeyState(0x5, sf::Keyboard::isKeyPressed(sf::Keyboard::Key::W)); // 5
-	chip.setKeyState(0x6, sf::Keyboard::isKeyPressed(sf::Keyboard::Key::E)); // 6
-	chip.setKeyState(0xD, sf::Keyboard::isKeyPressed(sf::Keyboard::Key::R)); // D
-
-	chip.setKeyState(0x7, sf::Keyboard::isKeyPressed(sf::Keyboard::Key::A)); // 7
-	chip.setKeyState(0x8, sf::Keyboard::isKeyPressed(sf::Keyboard::Key::S)); // 8
-	chip.setKeyState(0x9, sf::Keyboard::isKeyPressed(sf::Keyboard::Key::D)); // 9
-	chip.setKeyState(0xE, sf::Keyboard::isKeyPressed(sf::Keyboard::Key::F)); // E
-
-	chip.setKeyState(0xA, sf::Keyboard::isKeyPressed(sf::Keyboard::Key::Z)); // A
-	chip.setKeyState(0x0, sf::Keyboard::isKeyPressed(sf::Keyboard::Key::X)); // 0
-	chip.setKeyState(0xB, sf::Keyboard::isKeyPressed(sf::Keyboard::Key::C)); // B
-	chip.setKeyState(0xF, sf::Keyboard::isKeyPressed(sf::Keyboard::Key::V)); // F
-}
\ No newline at end of file
+	unsigned short keys = keypadState();
+	for(unsigned int i = 0; i < 16; i ++) {
+		chip.setKeyState(i, (keys & (1 << i)) != 0);
+	}
+}
+
+// Returns the keypad as a mask with bit n set when key n is held down
+unsigned short keypadState() {
+	static const sf::Keyboard::Key keyboard[16] = {
+		sf::Keyboard::Key::X,    // 0
+		sf::Keyboard::Key::Num1, // 1
+		sf::Keyboard::Key::Num2, // 2
+		sf::Keyboard::Key::Num3, // 3
+		sf::Keyboard::Key::Q,    // 4
+		sf::Keyboard::Key::W,    // 5
+		sf::Keyboard::Key::E,    // 6
+		sf::Keyboard::Key::A,    // 7
+		sf::Keyboard::Key::S,    // 8
+		sf::Keyboard::Key::D,    // 9
+		sf::Keyboard::Key::Z,    // A
+		sf::Keyboard::Key::C,    // B
+		sf::Keyboard::Key::Num4, // C
+		sf::Keyboard::Key::R,    // D
+		sf::Keyboard::Key::F,    // E
+		sf::Keyboard::Key::V     // F
+	};
+	unsigned short keys = 0;
+	for(unsigned int i = 0; i < 16; i ++) {
+		if(sf::Keyboard::isKeyPressed(keyboard[i])) {
+			keys |= 1 << i;
+		}
+	}
+	return keys;
+}
+
+/*
+Runs many instances of a game packed into a Chip8Arena as fast as possible without a window
+and reports how much memory they take and how many cycles a second they manage between them.
+*/
+int runBenchmark(std::string gameName, unsigned int instances) {
+	std::ifstream input(gameName, std::ios::binary);
+	if(!input || !input.is_open()) {
+		std::cout << "Error: problem opening " << gameName << std::endl;
+		return 1;
+	}
+	std::vector<unsigned char> rom((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+	input.close();
+
+	if(instances == 0) {
+		instances = 1;
+	}
+
+	Chip8Arena arena(instances);
+	for(unsigned int i = 0; i < instances; i ++) {
+		Chip8 * chip = arena.create();
+		if(rom.empty() || !chip->loadRom(&rom[0], (unsigned long) rom.size())) {
+			std::cout << "Error: " << gameName << " is to large to load into memory" << std::endl;
+			return 1;
+		}
+	}
+
+	std::cout << "Instances:     " << instances << std::endl;
+	std::cout << "Instance size: " << sizeof(Chip8) << " bytes" << std::endl;
+	std::cout << "Arena size:    " << arena.getBytes() << " bytes" << std::endl;
+
+	// run every instance a few cycles per round until a few seconds have passed
+	static const unsigned int batch = 16;
+	unsigned long long cycles = 0;
+	sf::Clock clock;
+	while(clock.getElapsedTime().asSeconds() < 3.f) {
+		for(unsigned int i = 0; i < instances; i ++) {
+			arena.get(i)->run(batch);
+		}
+		cycles += (unsigned long long) instances * batch;
+	}
+	float elapsed = clock.getElapsedTime().asSeconds();
+
+	std::cout << "Cycles:        " << cycles << " in " << elapsed << "s" << std::endl;
+	std::cout << "Cycles/s:      " << (unsigned long long) (cycles / elapsed) << std::endl;
+	return 0;
+}
+
+/*
+Runs the game without a window, serving the display to StreamClients on localhost until ctrl+c is pressed.
+*/
+int runServer(Chip8 & chip, unsigned short port, FrameCapture * capture, Telemetry & telemetry, TraceWriter * trace) {
+	StreamServer server(port);
+	if(!server.isListening()) {
+		return 1;
+	}
+	std::cout << "Serving on port " << port << std::endl;
+	signal(SIGINT, stopRunning);
+
+	static float refreshSpeed = 1.f/SPEED;
+	sf::Clock clock;
+	while(running) {
+		telemetry.enterPhase(TELEMETRY_EMULATION);
+		server.poll(chip);
+		if(trace != nullptr) {
+			chip.traceCycle(*trace);
+		}
+		else {
+			chip.cycle();
+		}
+		if(capture != nullptr) {
+			capture->submit(chip.getPackedGraphics(), chip.getHeight());
+		}
+		telemetry.enterPhase(TELEMETRY_RENDER);
+		bool drawn = chip.getNeedRedraw();
+		server.sendFrame(chip);
+		chip.setNeedRedraw(false);
+
+		// sleep off whatever is left of this 60th of a second
+		telemetry.enterPhase(TELEMETRY_SLEEP);
+		float left = refreshSpeed - clock.getElapsedTime().asSeconds();
+		if(left > 0) {
+			sf::sleep(sf::seconds(left));
+		}
+		clock.restart();
+		telemetry.endFrame(chip, 1, drawn);
+	}
+
+	if(server.getFramesSent() > 0) {
+		std::cout << "Sent " << server.getFramesSent() << " frames, " << (server.getBytesSent() / server.getFramesSent()) << " bytes a frame" << std::endl;
+	}
+	return 0;
+}
+
+/*
+Shows a game running in another process started with --serve, and sends it our key presses.
+*/
+int runClient(std::string address, Upscaler & upscaler, bool terminal) {
+	std::string host = "localhost";
+	unsigned short port = 0;
+	size_t colon = address.rfind(':');
+	if(colon != std::string::npos) {
+		host = address.substr(0, colon);
+		port = (unsigned short) atoi(address.substr(colon + 1).c_str());
+	}
+	else {
+		port = (unsigned short) atoi(address.c_str());
+	}
+
+	StreamClient client;
+	if(!client.connect(host, port)) {
+		return 1;
+	}
+
+	if(terminal) {
+		TerminalDisplay * display = new TerminalDisplay();
+		signal(SIGINT, stopRunning);
+		while(running && client.isConnected() && !display->quitRequested()) {
+			client.setKeys(display->readKeys());
+			client.poll();
+			if(client.getNeedRedraw()) {
+				display->draw(client.getPackedGraphics());
+				client.setNeedRedraw(false);
+			}
+			sf::sleep(sf::milliseconds(5));
+		}
+		delete display;
+		display = nullptr;
+	}
+	else {
+		sf::RenderWindow * window = new sf::RenderWindow(sf::VideoMode(upscaler.getOutputWidth(), upscaler.getOutputHeight()), "Chip 8 Emulator - " + address);
+		window->setFramerateLimit(60);
+		sf::Texture texture;
+		texture.create(upscaler.getOutputWidth(), upscaler.getOutputHeight());
+		while(window->isOpen() && client.isConnected()) {
+			sf::Event event;
+			while(window->pollEvent(event)) {
+				if(event.type == sf::Event::Closed) {
+					window->close();
+				}
+			}
+
+			client.setKeys(keypadState());
+			client.poll();
+			if(client.getNeedRedraw() || upscaler.isAnimated()) {
+				window->clear();
+				drawScreen(upscaler, texture, client.getPackedGraphics(), window);
+				window->display();
+				client.setNeedRedraw(false);
+			}
+		}
+		delete window;
+		window = nullptr;
+	}
+
+	if(client.getFramesReceived() > 0) {
+		std::cout << "Received " << client.getFramesReceived() << " frames, " << (client.getBytesReceived() / client.getFramesReceived()) << " bytes a frame" << std::endl;
+	}
+	return 0;
+}
+
+/*
+Parses a breakpoint like 2A4 or 2A4:V3==5, addresses and values are hex.
+The register can be V0-VF, I, SP, DT or ST and the comparison ==, !=, < or >.
+*/
+bool addBreakpoint(Debugger & debugger, std::string spec) {
+	unsigned short address = (unsigned short) strtol(spec.c_str(), nullptr, 16);
+	size_t colon = spec.find(':');
+	if(colon == std::string::npos) {
+		debugger.addBreakpoint(address);
+		return true;
+	}
+
+	std::string condition = spec.substr(colon + 1);
+	static const char * compares[] = { "==", "!=", "<", ">" };
+	for(unsigned int c = 0; c < 4; c ++) {
+		size_t at = condition.find(compares[c]);
+		if(at == std::string::npos) {
+			continue;
+		}
+		std::string name = condition.substr(0, at);
+		unsigned short value = (unsigned short) strtol(condition.substr(at + strlen(compares[c])).c_str(), nullptr, 16);
+
+		DebugRegister reg;
+		if(name.size() == 2 && (name[0] == 'V' || name[0] == 'v') && isxdigit(name[1])) {
+			reg = (DebugRegister) (DEBUG_V0 + strtol(name.substr(1).c_str(), nullptr, 16));
+		}
+		else if(name == "I") {
+			reg = DEBUG_I;
+		}
+		else if(name == "SP") {
+			reg = DEBUG_SP;
+		}
+		else if(name == "DT") {
+			reg = DEBUG_DT;
+		}
+		else if(name == "ST") {
+			reg = DEBUG_ST;
+		}
+		else {
+			break;
+		}
+		debugger.addConditionalBreakpoint(address, reg, (DebugCompare) c, value);
+		return true;
+	}
+	std::cout << "Error: can't understand breakpoint " << spec << std::endl;
+	return false;
+}
+
+/*
+Parses a watchpoint like 300 or 300-30F, with an optional r or w on the end to only watch reads or writes.
+*/
+bool addWatchpoint(Debugger & debugger, std::string spec) {
+	unsigned char flags = WATCH_READ | WATCH_WRITE;
+	char last = spec.empty() ? 0 : spec[spec.size() - 1];
+	if(last == 'r' || last == 'w') {
+		flags = last == 'r' ? WATCH_READ : WATCH_WRITE;
+		spec = spec.substr(0, spec.size() - 1);
+	}
+
+	char * end = nullptr;
+	unsigned short start = (unsigned short) strtol(spec.c_str(), &end, 16);
+	if(end == spec.c_str()) {
+		std::cout << "Error: can't understand watchpoint " << spec << std::endl;
+		return false;
+	}
+	unsigned short finish = start;
+	if(*end == '-') {
+		finish = (unsigned short) strtol(end + 1, nullptr, 16);
+	}
+	debugger.addWatchpoint(start, finish, flags);
+	return true;
+}
+
+/*
+Runs the game in the terminal instead of a window, for machines without a display. Escape or ctrl+c quits.
+*/
+int runTerminal(Chip8 & chip, FrameCapture * capture, Telemetry & telemetry, TraceWriter * trace) {
+	TerminalDisplay * display = new TerminalDisplay();
+	signal(SIGINT, stopRunning);
+
+	static float refreshSpeed = 1.f/SPEED;
+	sf::Clock clock;
+	while(running && !display->quitRequested()) {
+		telemetry.enterPhase(TELEMETRY_EMULATION);
+		unsigned short keys = display->readKeys();
+		for(unsigned int i = 0; i < 16; i ++) {
+			chip.setKeyState(i, (keys & (1 << i)) != 0);
+		}
+		if(trace != nullptr) {
+			chip.traceCycle(*trace);
+		}
+		else {
+			chip.cycle();
+		}
+		if(capture != nullptr) {
+			capture->submit(chip.getPackedGraphics(), chip.getHeight());
+		}
+		bool drawn = false;
+		if(chip.getNeedRedraw()) {
+			telemetry.enterPhase(TELEMETRY_RENDER);
+			display->draw(chip.getPackedGraphics());
+			chip.setNeedRedraw(false);
+			drawn = true;
+		}
+
+		// sleep off whatever is left of this 60th of a second
+		telemetry.enterPhase(TELEMETRY_SLEEP);
+		float left = refreshSpeed - clock.getElapsedTime().asSeconds();
+		if(left > 0) {
+			sf::sleep(sf::seconds(left));
+		}
+		clock.restart();
+		telemetry.endFrame(chip, 1, drawn);
+	}
+
+	unsigned long long frames = display->getFramesWritten();
+	unsigned long long bytes = display->getBytesWritten();
+	delete display;
+	display = nullptr;
+
+	if(frames > 0) {
+		std::cout << "Drew " << frames << " frames, " << (bytes / frames) << " bytes a frame" << std::endl;
+	}
+	return 0;
+}
+
+// Finishes writing a trace started with --trace and says how big it came out
+void closeTrace(TraceWriter * trace) {
+	if(trace == nullptr) {
+		return;
+	}
+	trace->stop();
+	if(trace->getRecords() > 0) {
+		std::cout << "Traced " << trace->getRecords() << " instructions in " << trace->getBytesWritten() << " bytes" << std::endl;
+	}
+	delete trace;
+}
+
+void printTraceRecord(std::string name, unsigned long long cycle, const TraceRecord & record) {
+	std::stringstream ss;
+	ss << std::hex << std::uppercase << std::setfill('0');
+	ss << name << " cycle " << std::dec << cycle << std::hex << ": PC=" << std::setw(3) << record.pc << " " << std::setw(4) << record.opcode;
+	ss << " I=" << std::setw(3) << record.I;
+	for(unsigned int i = 0; i < 16; i ++) {
+		if(record.changed & (1 << i)) {
+			ss << " V" << i << "=" << std::setw(2) << (unsigned int) record.values[i];
+		}
+	}
+	std::cout << ss.str() << std::endl;
+}
+
+/*
+Compares two traces written with --trace and reports the first cycle where they differ.
+Blocks whose compressed bytes are the same hold the same records, so everything before the first block that differs is skipped without decoding it.
+Returns 0 if the traces are the same.
+*/
+int runTraceDiff(std::string first, std::string second) {
+	TraceReader a(first);
+	TraceReader b(second);
+	if(!a.isOpen() || !b.isOpen()) {
+		return 1;
+	}
+
+	unsigned long long cycle = 0;
+	if(a.getBlockSize() == b.getBlockSize()) {
+		std::vector<unsigned char> bytesA;
+		std::vector<unsigned char> bytesB;
+		unsigned int block = 0;
+		while(block < a.getBlockCount() && block < b.getBlockCount()) {
+			if(!a.readBlock(block, bytesA) || !b.readBlock(block, bytesB) || bytesA != bytesB) {
+				break;
+			}
+			block ++;
+		}
+		cycle = (unsigned long long) block * a.getBlockSize();
+	}
+
+	TraceRecord recordA;
+	TraceRecord recordB;
+	while(true) {
+		bool haveA = a.read(cycle, recordA);
+		bool haveB = b.read(cycle, recordB);
+		if(!haveA || !haveB) {
+			if(haveA == haveB) {
+				std::cout << "Traces are the same for all " << cycle << " cycles" << std::endl;
+				return 0;
+			}
+			std::cout << "Traces are the same for " << cycle << " cycles, then " << (haveA ? second : first) << " ends" << std::endl;
+			return 1;
+		}
+		if(recordA.pc != recordB.pc || recordA.opcode != recordB.opcode || recordA.I != recordB.I
+			|| recordA.changed != recordB.changed || memcmp(recordA.values, recordB.values, sizeof(recordA.values)) != 0) {
+			break;
+		}
+		cycle ++;
+	}
+
+	std::cout << "Traces diverge at cycle " << cycle << std::endl;
+	TraceRecord before;
+	if(cycle > 0 && a.read(cycle - 1, before)) {
+		printTraceRecord("both", cycle - 1, before);
+	}
+	printTraceRecord(first, cycle, recordA);
+	printTraceRecord(second, cycle, recordB);
+	return 1;
+}